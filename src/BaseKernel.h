@@ -0,0 +1,166 @@
+#ifndef BASEKERNEL_H_
+#define BASEKERNEL_H_
+
+#include <stdint.h>
+#include <cstddef>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KMERS_X86_KERNELS
+#endif
+
+namespace kmers
+{
+
+/**
+ * Translation of ASCII bases into the 3 bit codes of Mer.h (a=0, c=1, g=2, t=3, n=4, either case) a whole block at a
+ * time. Next to the codes every group of 64 bytes gets a bitmask of its "special" bytes - anything that is not one of
+ * acgt (n, line breaks, invalid chars) - so the counter can roll over the groups without a single special byte without
+ * looking at the chars at all. The code of a special byte is unspecified, its char has to be looked at.
+ *
+ * The vector kernels look the code and the expected (lower case) char up by the low nibble with a byte shuffle:
+ * a, c, g, t, n all have different low nibbles. The widest one the cpu supports is picked at runtime.
+ */
+namespace kernel
+{
+
+static const size_t groupSize = 64;
+static const uint8_t invalidCode = 0xff;
+
+struct BaseTable
+{
+	BaseTable()
+	{
+		std::fill(codes, codes + 256, invalidCode);
+		const char bases[] = {'a', 'c', 'g', 't', 'n'};
+		for(uint8_t i=0;i<5;i++)
+		{
+			codes[(uint8_t)bases[i]] = i;
+			codes[(uint8_t)(bases[i] - 'a' + 'A')] = i;
+		}
+	}
+	uint8_t codes[256];
+};
+
+/*
+ * code of every byte, invalidCode for the ones that are not bases
+ */
+inline const uint8_t* baseCodes()
+{
+	static const BaseTable table;
+	return table.codes;
+}
+
+/*
+ * codes: len bytes, special: (len + groupSize - 1) / groupSize masks
+ */
+using TranslateFn = void (*)(const char* src, size_t len, uint8_t* codes, uint64_t* special);
+
+inline void translateScalar(const char* src, size_t len, uint8_t* codes, uint64_t* special)
+{
+	const uint8_t* table = baseCodes();
+	for(size_t g = 0; g * groupSize < len; g++)
+	{
+		size_t begin = g * groupSize;
+		size_t end = std::min(len, begin + groupSize);
+		uint64_t mask = 0;
+		for(size_t i=begin;i<end;i++)
+		{
+			uint8_t code = table[(uint8_t)src[i]];
+			codes[i] = code;
+			mask |= (uint64_t)(code > 3) << (i - begin);
+		}
+		special[g] = mask;
+	}
+}
+
+#ifdef KMERS_X86_KERNELS
+
+// by low nibble: a/A=1, c/C=3, g/G=7, t/T=4 (n/N=14 is special so it is not in the tables)
+#define KMERS_CODE_LUT  -1, 0, -1, 1, 3, -1, -1, 2, -1, -1, -1, -1, -1, -1, 4, -1
+#define KMERS_LOWER_LUT  0, 'a', 0, 'c', 't', 0, 0, 'g', 0, 0, 0, 0, 0, 0, 0, 0
+
+__attribute__((target("ssse3")))
+inline void translateSSSE3(const char* src, size_t len, uint8_t* codes, uint64_t* special)
+{
+	const __m128i codeLut = _mm_setr_epi8(KMERS_CODE_LUT);
+	const __m128i lowerLut = _mm_setr_epi8(KMERS_LOWER_LUT);
+	const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+	const __m128i lowerBit = _mm_set1_epi8(0x20);
+	size_t full = len / groupSize;
+	for(size_t g = 0; g < full; g++)
+	{
+		uint64_t acgt = 0;
+		for(size_t j = 0; j < groupSize; j += 16)
+		{
+			size_t i = g * groupSize + j;
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			__m128i nibble = _mm_and_si128(c, nibbleMask);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(codes + i), _mm_shuffle_epi8(codeLut, nibble));
+			__m128i valid = _mm_cmpeq_epi8(_mm_or_si128(c, lowerBit), _mm_shuffle_epi8(lowerLut, nibble));
+			acgt |= (uint64_t)(uint16_t)_mm_movemask_epi8(valid) << j;
+		}
+		special[g] = ~acgt;
+	}
+	if(full * groupSize < len)
+		translateScalar(src + full * groupSize, len - full * groupSize, codes + full * groupSize, special + full);
+}
+
+__attribute__((target("avx2")))
+inline void translateAVX2(const char* src, size_t len, uint8_t* codes, uint64_t* special)
+{
+	const __m256i codeLut = _mm256_setr_epi8(KMERS_CODE_LUT, KMERS_CODE_LUT);
+	const __m256i lowerLut = _mm256_setr_epi8(KMERS_LOWER_LUT, KMERS_LOWER_LUT);
+	const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+	const __m256i lowerBit = _mm256_set1_epi8(0x20);
+	size_t full = len / groupSize;
+	for(size_t g = 0; g < full; g++)
+	{
+		uint64_t acgt = 0;
+		for(size_t j = 0; j < groupSize; j += 32)
+		{
+			size_t i = g * groupSize + j;
+			__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+			__m256i nibble = _mm256_and_si256(c, nibbleMask);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(codes + i), _mm256_shuffle_epi8(codeLut, nibble));
+			__m256i valid = _mm256_cmpeq_epi8(_mm256_or_si256(c, lowerBit), _mm256_shuffle_epi8(lowerLut, nibble));
+			acgt |= (uint64_t)(uint32_t)_mm256_movemask_epi8(valid) << j;
+		}
+		special[g] = ~acgt;
+	}
+	if(full * groupSize < len)
+		translateScalar(src + full * groupSize, len - full * groupSize, codes + full * groupSize, special + full);
+}
+
+#undef KMERS_CODE_LUT
+#undef KMERS_LOWER_LUT
+
+#endif
+
+inline TranslateFn selectTranslate()
+{
+#ifdef KMERS_X86_KERNELS
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return translateAVX2;
+	if(__builtin_cpu_supports("ssse3"))
+		return translateSSSE3;
+#endif
+	return translateScalar;
+}
+
+/*
+ * the kernel picked for this cpu
+ */
+inline void translateBases(const char* src, size_t len, uint8_t* codes, uint64_t* special)
+{
+	static const TranslateFn translate = selectTranslate();
+	translate(src, len, codes, special);
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef BLOOMFILTER_H_
+#define BLOOMFILTER_H_
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+namespace kmers
+{
+
+/**
+ * Lock free Bloom filter shared by all the workers. It is blocked down to a single 64 bit word: the key hash picks the
+ * word and numOfHashes bits inside it, so testAndSet is one fetch_or - of two workers seeing the same key at the same
+ * time exactly one is told it was there already. A bit worse false positive rate than a plain Bloom filter of the same
+ * size (~1% at 16 bits per key) for one cache miss per key and no lost sightings.
+ */
+template<class Key, class Hash>
+class BloomFilter
+{
+public:
+	BloomFilter(size_t bits, size_t numOfHashes = 4) : _numOfHashes(numOfHashes < 1 ? 1 : (numOfHashes > 10 ? 10 : numOfHashes))
+	{
+		_numOfWords = 2;
+		_shift = 63;
+		while(_numOfWords * 64 < bits)
+		{
+			_numOfWords <<= 1;
+			--_shift;
+		}
+		_words.reset(new std::atomic<uint64_t>[_numOfWords]);
+		for(size_t i=0;i<_numOfWords;i++)
+			_words[i].store(0, std::memory_order_relaxed);
+	}
+
+	size_t memoryUsage() const {return _numOfWords * sizeof(uint64_t);}
+
+	/*
+	 * adds the key - returns whether it was (or looked like it was) added before
+	 */
+	inline bool testAndSet(const Key& key)
+	{
+		uint64_t h = _hash(key);
+		std::atomic<uint64_t>& word = _words[(h * 0x9e3779b97f4a7c15ULL) >> _shift];
+		uint64_t mask = bitsOf(h);
+		// the keys seen many times should not keep writing the cache line
+		if((word.load(std::memory_order_relaxed) & mask) == mask)
+			return true;
+		return (word.fetch_or(mask, std::memory_order_relaxed) & mask) == mask;
+	}
+
+	inline bool contains(const Key& key) const
+	{
+		uint64_t h = _hash(key);
+		uint64_t mask = bitsOf(h);
+		return (_words[(h * 0x9e3779b97f4a7c15ULL) >> _shift].load(std::memory_order_relaxed) & mask) == mask;
+	}
+
+private:
+	// 6 bits of the (remixed) hash per bit position
+	inline uint64_t bitsOf(uint64_t h) const
+	{
+		uint64_t g = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ULL;
+		uint64_t mask = 0;
+		for(size_t i=0;i<_numOfHashes;i++)
+			mask |= 1ULL << ((g >> (6 * i)) & 63);
+		return mask;
+	}
+
+private:
+	size_t	 _numOfHashes;
+	size_t	 _numOfWords;
+	unsigned _shift;
+	std::unique_ptr<std::atomic<uint64_t>[]> _words;
+	Hash	 _hash;
+};
+
+}
+
+#endif
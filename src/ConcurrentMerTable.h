@@ -0,0 +1,290 @@
+#ifndef CONCURRENTMERTABLE_H_
+#define CONCURRENTMERTABLE_H_
+
+#include <Mer.h>
+#include <MemoryBudget.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace kmers
+{
+
+/**
+ * Open addressed (linear probing) kmer -> count table all the workers count into at the same time. A key is claimed
+ * with a CAS on the state of its slot (empty -> busy -> ready, the key is written while busy), a count is a fetch_add -
+ * there are no locks on the counting path and nothing to merge afterwards.
+ *
+ * Writers register for the time they are inserting (Writer). Growing needs the table to itself: the thread finding it
+ * too full raises the resize flag, the writers step out at their next insert and wait, the slots are moved into a table
+ * twice the size by a few threads in parallel (the moves are CAS inserts of distinct keys) and everyone goes on. With
+ * a good initial size this happens a few times at most.
+ *
+ * With a budget the slots are taken from it - the initial size is cut to half of what is left of it, growing takes
+ * what it needs regardless (the table can not be spilled).
+ */
+template<class Mer, class Hash = mer_encoded_hash<Mer>>
+class ConcurrentMerTable
+{
+	enum : uint32_t {Empty = 0, Busy = 1, Ready = 2};
+
+	struct Slot
+	{
+		Mer					  key;
+		std::atomic<uint64_t> count;
+		std::atomic<uint32_t> state;
+	};
+
+	enum class Insert {Added, Existing, Full};
+public:
+	/*
+	 * a registered writer - only valid on the thread that created it, inserts are only allowed through it
+	 */
+	class Writer
+	{
+	public:
+		Writer(ConcurrentMerTable& table) : _table(table), _added(0) {_table.enter();}
+		~Writer()
+		{
+			_table.publish(_added);
+			_table.leave();
+		}
+
+		inline void add(const Mer& mer, uint64_t count = 1) {_table.add(mer, count, _added);}
+
+	private:
+		Writer(const Writer&) = delete;
+		Writer& operator=(const Writer&) = delete;
+
+		ConcurrentMerTable& _table;
+		size_t				_added;		// new keys not yet added to the size of the table
+	};
+
+	ConcurrentMerTable(size_t initialSize, float maxLoadFactor = 0.7f, MemoryBudget* budget = nullptr) :
+																		 _maxLoadFactor(maxLoadFactor),
+																		 _size(0),
+																		 _writers(0),
+																		 _resizing(false),
+																		 _budget(budget)
+	{
+		size_t capacity = _minCapacity;
+		while(capacity * _maxLoadFactor < initialSize)
+			capacity <<= 1;
+		while(_budget && capacity > _minCapacity && capacity * sizeof(Slot) > _budget->available() / 2)
+			capacity >>= 1;
+		allocate(capacity);
+	}
+
+	~ConcurrentMerTable()
+	{
+		if(_budget)
+			_budget->release(memoryUsage());
+	}
+
+	/*
+	 * not thread safe - only once the writers are gone
+	 */
+	size_t size() const {return _size.load();}
+	size_t capacity() const {return _capacity;}
+	size_t memoryUsage() const {return _capacity * sizeof(Slot);}
+
+	/*
+	 * calls fn(mer, count) for the keys of the slots [begin, end) of capacity() - not thread safe with the writers, but
+	 * disjoint ranges can be walked in parallel
+	 */
+	template<class Fn>
+	void forEach(size_t begin, size_t end, Fn fn) const
+	{
+		for(size_t i=begin;i<end && i<_capacity;i++)
+		{
+			const Slot& slot = _slots[i];
+			if(slot.state.load(std::memory_order_relaxed) == Ready)
+				fn(slot.key, (size_t)slot.count.load(std::memory_order_relaxed));
+		}
+	}
+
+	template<class Fn>
+	void forEach(Fn fn) const {forEach(0, _capacity, fn);}
+
+private:
+	void allocate(size_t capacity)
+	{
+		_capacity = capacity;
+		_mask = capacity - 1;
+		_shift = 64;
+		for(size_t c = capacity; c > 1; c >>= 1)
+			--_shift;
+		_growAt = (size_t)(capacity * _maxLoadFactor);
+		_maxProbes = capacity < _probeLimit ? capacity : _probeLimit;
+		// value initialized: every slot starts out empty
+		_slots.reset(new Slot[capacity]());
+		if(_budget)
+			_budget->reserve(memoryUsage());
+	}
+
+	inline size_t home(uint64_t h) const {return (size_t)((h * 0x9e3779b97f4a7c15ULL) >> _shift);}
+
+	inline Insert insert(const Mer& mer, uint64_t h, uint64_t count)
+	{
+		size_t i = home(h);
+		for(size_t probe = 0; probe < _maxProbes; probe++, i = (i + 1) & _mask)
+		{
+			Slot& slot = _slots[i];
+			uint32_t state = slot.state.load(std::memory_order_acquire);
+			if(state == Empty)
+			{
+				if(slot.state.compare_exchange_strong(state, Busy, std::memory_order_acq_rel))
+				{
+					slot.key = mer;
+					slot.count.store(count, std::memory_order_relaxed);
+					slot.state.store(Ready, std::memory_order_release);
+					return Insert::Added;
+				}
+			}
+			// somebody is just writing the key of the slot
+			while(state == Busy)
+			{
+				std::this_thread::yield();
+				state = slot.state.load(std::memory_order_acquire);
+			}
+			if(slot.key == mer)
+			{
+				slot.count.fetch_add(count, std::memory_order_relaxed);
+				return Insert::Existing;
+			}
+		}
+		return Insert::Full;
+	}
+
+	void add(const Mer& mer, uint64_t count, size_t& added)
+	{
+		uint64_t h = _hash(mer);
+		while(true)
+		{
+			if(_resizing.load(std::memory_order_acquire))
+			{
+				leave();
+				enter();
+				continue;
+			}
+			size_t capacity = _capacity;
+			Insert res = insert(mer, h, count);
+			if(res == Insert::Existing)
+				return;
+			if(res == Insert::Added)
+			{
+				if(++added < _publishEvery)
+					return;
+				size_t size = publish(added);
+				if(size < _growAt)
+					return;
+			}
+			// too full (or too long a probe) - grow and go again if the key is not in yet
+			publish(added);
+			leave();
+			grow(capacity);
+			enter();
+			if(res == Insert::Added)
+				return;
+		}
+	}
+
+	inline size_t publish(size_t& added)
+	{
+		size_t size = _size.fetch_add(added) + added;
+		added = 0;
+		return size;
+	}
+
+	/*
+	 * registers the thread as a writer - waits for a resize to finish
+	 */
+	void enter()
+	{
+		while(true)
+		{
+			_writers.fetch_add(1);
+			if(!_resizing.load())
+				return;
+			_writers.fetch_sub(1);
+			while(_resizing.load(std::memory_order_acquire))
+				std::this_thread::yield();
+		}
+	}
+
+	void leave() {_writers.fetch_sub(1);}
+
+	/*
+	 * doubles the table unless somebody else did it since the capacity was seen - no writers are registered
+	 */
+	void grow(size_t seenCapacity)
+	{
+		bool expected = false;
+		if(!_resizing.compare_exchange_strong(expected, true))
+		{
+			while(_resizing.load(std::memory_order_acquire))
+				std::this_thread::yield();
+			return;
+		}
+		while(_writers.load() != 0)
+			std::this_thread::yield();
+
+		if(_capacity == seenCapacity)
+		{
+			std::unique_ptr<Slot[]> old(_slots.release());
+			size_t oldCapacity = _capacity;
+			allocate(oldCapacity * 2);
+			_maxProbes = _capacity;		// every key fits in the new table
+			size_t numOfThreads = oldCapacity < _parallelMoveFrom ? 1 : std::thread::hardware_concurrency();
+			if(numOfThreads < 1)
+				numOfThreads = 1;
+			size_t range = (oldCapacity + numOfThreads - 1) / numOfThreads;
+			std::vector<std::thread> threads;
+			for(size_t t=1;t<numOfThreads;t++)
+				threads.push_back(std::thread([this, &old, t, range, oldCapacity]() { move(old.get(), t * range, std::min(oldCapacity, (t + 1) * range)); }));
+			move(old.get(), 0, std::min(oldCapacity, range));
+			for(std::thread& t : threads)
+				t.join();
+			if(_budget)
+				_budget->release(oldCapacity * sizeof(Slot));
+			_maxProbes = _capacity < _probeLimit ? _capacity : _probeLimit;
+		}
+		_resizing.store(false, std::memory_order_release);
+	}
+
+	void move(Slot* from, size_t begin, size_t end)
+	{
+		for(size_t i=begin;i<end;i++)
+		{
+			if(from[i].state.load(std::memory_order_relaxed) == Ready)
+				insert(from[i].key, _hash(from[i].key), from[i].count.load(std::memory_order_relaxed));
+		}
+	}
+
+private:
+	static const size_t _minCapacity = 1024;
+	static const size_t _probeLimit = 4096;
+	static const size_t _publishEvery = 256;
+	static const size_t _parallelMoveFrom = 1 << 20;
+
+	float					 _maxLoadFactor;
+	size_t					 _capacity;
+	size_t					 _mask;
+	unsigned				 _shift;
+	size_t					 _growAt;
+	size_t					 _maxProbes;
+	std::unique_ptr<Slot[]>	 _slots;
+	std::atomic<size_t>		 _size;
+	std::atomic<size_t>		 _writers;
+	std::atomic<bool>		 _resizing;
+	MemoryBudget*			 _budget;
+	Hash					 _hash;
+};
+
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef COUNTMINSKETCH_H_
+#define COUNTMINSKETCH_H_
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+namespace kmers
+{
+
+/**
+ * Count-Min sketch with conservative update: depth rows of width counters, every key hits one counter per row and
+ * its estimate is the smallest of them - never below the true count, above it by at most epsilon * totalCount() with
+ * probability 1 - e^-depth (epsilon = e / width). The conservative update only raises the counters of a key as far as
+ * its new estimate, which keeps the overshoot well below the bound for skewed inputs.
+ *
+ * Sketches of the same shape merge by adding them counter by counter (the merged one still never undercounts).
+ * The width is a power of two, the rows are picked by double hashing of the one key hash.
+ */
+template<class Key, class Hash>
+class CountMinSketch
+{
+public:
+	using counter_type = uint32_t;
+
+	CountMinSketch(size_t width, size_t depth) : _width(roundUpPow2(width)),
+												 _depth(depth == 0 ? 1 : (depth > _maxDepth ? _maxDepth : depth)),
+												 _total(0)
+	{
+		_mask = _width - 1;
+		_counters.resize(_width * _depth, 0);
+	}
+
+	/*
+	 * the shape for an error bound of epsilon * totalCount() within bytes: width from epsilon, as many rows as fit up to
+	 * maxDepth - at least minDepth rows though (a single row goes wrong with probability 1/e), the width shrinks to make
+	 * room for them if the budget is tight (and the bound grows accordingly)
+	 */
+	static void shapeFromBudget(size_t bytes, double epsilon, size_t& width, size_t& depth, size_t minDepth = 4, size_t maxDepth = 8)
+	{
+		if(epsilon <= 0.0)
+			throw std::runtime_error("The error bound of the sketch has to be positive!");
+		width = roundUpPow2((size_t)std::ceil(std::exp(1.0) / epsilon));
+		while(width > 1 && width * minDepth * sizeof(counter_type) > bytes)
+			width >>= 1;
+		depth = std::min(std::max(bytes / (width * sizeof(counter_type)), minDepth), maxDepth);
+	}
+
+	static CountMinSketch fromBudget(size_t bytes, double epsilon)
+	{
+		size_t width, depth;
+		shapeFromBudget(bytes, epsilon, width, depth);
+		return CountMinSketch(width, depth);
+	}
+
+	size_t width() const {return _width;}
+	size_t depth() const {return _depth;}
+	size_t memoryUsage() const {return _counters.size() * sizeof(counter_type);}
+	unsigned long long totalCount() const {return _total;}
+
+	double epsilon() const {return std::exp(1.0) / _width;}
+	// probability of an estimate being within errorBound()
+	double confidence() const {return 1.0 - std::exp(-(double)_depth);}
+	unsigned long long errorBound() const {return (unsigned long long)std::ceil(epsilon() * _total);}
+
+	/*
+	 * conservative update - returns the new estimate of the key
+	 */
+	counter_type add(const Key& key, size_t count = 1)
+	{
+		_total += count;
+		size_t cols[_maxDepth];
+		columns(key, cols);
+		counter_type est = std::numeric_limits<counter_type>::max();
+		for(size_t r=0;r<_depth;r++)
+			est = std::min(est, _counters[r * _width + cols[r]]);
+		counter_type target = saturatingAdd(est, count);
+		for(size_t r=0;r<_depth;r++)
+		{
+			counter_type& c = _counters[r * _width + cols[r]];
+			if(c < target)
+				c = target;
+		}
+		return target;
+	}
+
+	counter_type estimate(const Key& key) const
+	{
+		size_t cols[_maxDepth];
+		columns(key, cols);
+		counter_type est = std::numeric_limits<counter_type>::max();
+		for(size_t r=0;r<_depth;r++)
+			est = std::min(est, _counters[r * _width + cols[r]]);
+		return est;
+	}
+
+	void merge(const CountMinSketch& other)
+	{
+		if(other._width != _width || other._depth != _depth)
+			throw std::runtime_error("Only sketches of the same shape can be merged!");
+		for(size_t i=0;i<_counters.size();i++)
+			_counters[i] = saturatingAdd(_counters[i], other._counters[i]);
+		_total += other._total;
+	}
+
+private:
+	inline void columns(const Key& key, size_t* cols) const
+	{
+		uint64_t h1 = _hash(key);
+		uint64_t h2 = ((h1 >> 32) | (h1 << 32)) * 0x9e3779b97f4a7c15ULL | 1;
+		for(size_t r=0;r<_depth;r++)
+			cols[r] = (h1 + r * h2) & _mask;
+	}
+
+	static inline counter_type saturatingAdd(counter_type a, size_t b)
+	{
+		size_t sum = (size_t)a + b;
+		return sum > std::numeric_limits<counter_type>::max() ? std::numeric_limits<counter_type>::max() : (counter_type)sum;
+	}
+
+	static size_t roundUpPow2(size_t n)
+	{
+		size_t p = 1;
+		while(p < n)
+			p <<= 1;
+		return p;
+	}
+
+private:
+	static const size_t _maxDepth = 32;
+
+	size_t				 _width;
+	size_t				 _depth;
+	size_t				 _mask;
+	unsigned long long	 _total;
+	std::vector<counter_type> _counters;
+	Hash				 _hash;
+};
+
+}
+
+#endif
@@ -0,0 +1,731 @@
+#ifndef COUNTINGSTAGE_H_
+#define COUNTINGSTAGE_H_
+
+#include <KmerCounter.h>
+#include <SequenceParser.h>
+#include <MerMap.h>
+#include <PartitionAggregator.h>
+#include <KmerResultCollector.h>
+#include <TopN.h>
+#include <MemoryBudget.h>
+#include <KmerDatabase.h>
+#include <Histogram.h>
+#include <Metrics.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+
+namespace kmers
+{
+
+using std::unique_ptr;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+using std::pair;
+using std::thread;
+using std::atomic;
+
+
+/*
+ * a block of the input to count: the sequence segments the parser cut it into and the continuation of the last
+ * segment's record in the next block (empty if the record ends in the block) - chunkMemory/nextMemory keep the buffers
+ * under the chunks alive (streamed input) until every task looking at them is done, they are empty for mapped input
+ */
+struct BlockTask
+{
+	vector<Chunk> segments;
+	Chunk next;
+	shared_ptr<const char> chunkMemory;
+	shared_ptr<const char> nextMemory;
+};
+
+/*
+ * numOfWorkers: the worker ids count gets called with are 0..numOfWorkers-1
+ * numOfPartitions: number of hash partitions (and aggregator threads) of the kmer space
+ * partitionConfig: initial database of a partition - it grows as long as the budget allows and is spilled after that
+ * workerConfig/workerFlushThreshold: table of a worker and the size it is flushed to the partitions at (both shrink to
+ * fit a small budget)
+ * budget: the memory everything the stage holds is taken from (a budget of half the physical memory if not given)
+ * maxPendingBatches: how far an aggregator can fall behind before the workers block
+ * approximate: count into Count-Min sketches of sketchMemory bytes per worker aiming for an error of sketchError times the
+ * total count instead of the exact tables (no partitions, no spills)
+ * prefilterBits: exact mode - a kmer only gets into the tables on its second sighting, the first ones go into a shared
+ * Bloom filter of that many bits (0: no prefilter). fixup: recount the candidates for the top n exactly in a second pass
+ * sharedTable: all the workers count into one concurrent table pre-sized for sharedTableSize kmers instead of their own
+ * tables flushed to the partitions (everything stays in memory, nothing is merged or spilled)
+ * databasePath: exact mode - every kmer with its count is written to a KmerDatabase there once counting is done
+ * numOfStages: stages counting side by side into the same budget (one per k) - each one plans with its share of it
+ * histogram: exact mode - the abundance histogram of all the kmers is built on the way while collecting the results
+ * metrics: the partitions time their merges and spills into it, the tables are recorded once counted (null: none)
+ * spillPrefix: the runs of the partitions are written to <spillPrefix>_<k>_<partition>_<run>
+ */
+struct CountingConfig
+{
+	CountingConfig() : numOfWorkers(1), numOfPartitions(1), partitionConfig(0, 0.7f), workerConfig(0, 0.7f),
+					   workerFlushThreshold(1), maxPendingBatches(1), canonical(false), approximate(false), sketchMemory(0),
+					   sketchError(0), prefilterBits(0), fixup(false),
+					   sharedTable(false), sharedTableSize(0), budget(nullptr), numOfStages(1), histogram(false), metrics(nullptr),
+					   spillPrefix("map") {}
+	size_t			numOfWorkers;
+	size_t			numOfPartitions;
+	HashTableConfig	partitionConfig;
+	HashTableConfig	workerConfig;
+	size_t			workerFlushThreshold;
+	size_t			maxPendingBatches;
+	bool			canonical;
+	bool			approximate;
+	size_t			sketchMemory;
+	double			sketchError;
+	size_t			prefilterBits;
+	bool			fixup;
+	bool			sharedTable;
+	size_t			sharedTableSize;
+	MemoryBudget*	budget;
+	string			databasePath;
+	size_t			numOfStages;
+	bool			histogram;
+	Metrics*		metrics;
+	string			spillPrefix;
+};
+
+
+/*
+ * The part of the engine that depends on the key width: the worker tables and the partitions. The engine only sees
+ * this interface, the width is picked once from k by makeCountingStage and everything below it is compiled for it.
+ */
+class CountingStageBase
+{
+public:
+	virtual ~CountingStageBase() {}
+
+	// starts the partition aggregators
+	virtual void start() = 0;
+	// runs on the worker - counts the block into the worker's own table, returns the kmers of the block
+	virtual size_t count(size_t worker, const BlockTask& task) = 0;
+	// same for a block scanned once for the stages of several k: the worker's codes go to the sink handed out until
+	// endBlock, which returns the kmers of the block
+	virtual CodeSink& beginBlock(size_t worker) = 0;
+	virtual size_t endBlock(size_t worker) = 0;
+	// the block failed half way: the stage is done with it as after endBlock, what the worker's table holds may be dropped
+	virtual void abortBlock(size_t worker) {endBlock(worker);}
+	// no more blocks are coming - flushes the worker tables and waits for the partitions to merge everything
+	virtual void finish() = 0;
+	// the decoded top n (ties included), biggest count first
+	virtual vector<pair<string, size_t>> results() = 0;
+	virtual unsigned long long totalKmerCount() const = 0;
+	virtual size_t numOfPartitions() const = 0;
+
+	// after finish: the input has to be counted once more (start the second pass, count, finish) before the results
+	virtual bool needsSecondPass() const {return false;}
+	virtual void startSecondPass() {}
+
+	// estimated count of a single kmer - only the approximate stage keeps anything to answer it from
+	virtual size_t estimate(const string& /*kmer*/) const
+	{
+		throw std::runtime_error("Point counts are only available in the approximate mode!");
+	}
+	// the reported counts are above the true ones by at most errorBound with probability errorConfidence (exact: 0, 1)
+	virtual unsigned long long errorBound() const {return 0;}
+	virtual double errorConfidence() const {return 1.0;}
+
+	// the abundance histogram of every kmer - once the results are there (exact mode with CountingConfig::histogram)
+	virtual const Histogram& histogram() const
+	{
+		throw std::runtime_error("The histogram is only available in the exact mode!");
+	}
+};
+
+
+template<class Mer>
+class CountingStage : public CountingStageBase
+{
+	using Counter = KmerCounter<Mer>;
+	using CounterPtr = unique_ptr<Counter>;
+	using Partition = PartitionAggregator<Mer>;
+	using PartitionPtr = unique_ptr<Partition>;
+	using MerCount = mer_count<Mer>;
+	using Prefilter = typename Counter::Prefilter;
+	using HashMap = typename Counter::HashMap;
+	using SharedTable = typename Counter::SharedTable;
+public:
+	CountingStage(size_t k, size_t n, const CountingConfig& config) : _k(k), _n(n), _config(config), _totalKmerCount(0),
+																	  _filteredCount(0), _reserved(0), _secondPass(false)
+	{
+		if(_config.numOfPartitions == 0)
+			_config.numOfPartitions = 1;
+		if(!_config.budget)
+		{
+			_ownBudget.reset(new MemoryBudget(0));
+			_config.budget = _ownBudget.get();
+		}
+		MemoryBudget& budget = *_config.budget;
+		if(_config.prefilterBits)
+		{
+			_prefilter.reset(new Prefilter(_config.prefilterBits));
+			_reserved += _prefilter->memoryUsage();
+		}
+		_workerCounters.resize(std::max(_config.numOfWorkers, (size_t)1));
+		_blockStart.resize(_workerCounters.size(), 0);
+		_writers.resize(_workerCounters.size());
+		if(_config.sharedTable)
+			_shared.reset(new SharedTable(_config.sharedTableSize, 0.7f, &budget));
+		else
+			fitToBudget(budget);
+		budget.reserve(_reserved);
+		for(size_t i=0;i<_config.numOfPartitions && !_shared;i++)
+		{
+			_partitions.push_back(PartitionPtr(new Partition(i, _n, _k, _config.partitionConfig,
+															 budget, _config.maxPendingBatches, _config.metrics,
+															 _config.spillPrefix)));
+		}
+	}
+
+	~CountingStage()
+	{
+		_partitions.clear();
+		_shared.reset();
+		_config.budget->release(_reserved);
+	}
+
+	void start()
+	{
+		for(auto& partition : _partitions)
+			partition->start();
+	}
+
+	/*
+	 * counts into the worker's own table which is only flushed to the partitions once full - the second pass only counts
+	 * the candidates, the worker tables never get bigger than the candidate set there. With the shared table the worker's
+	 * counter only does the rolling, every kmer goes into the shared table
+	 */
+	size_t count(size_t worker, const BlockTask& task)
+	{
+		Counter& counter = enter(worker);
+		try
+		{
+			counter.count(task.segments, task.next);
+		}
+		catch(...)
+		{
+			leave(worker, true);
+			throw;
+		}
+		return leave(worker);
+	}
+
+	CodeSink& beginBlock(size_t worker) {return enter(worker);}
+	size_t endBlock(size_t worker) {return leave(worker);}
+	void abortBlock(size_t worker) {leave(worker, true);}
+
+	void finish()
+	{
+		if(_secondPass)
+		{
+			for(CounterPtr& counter : _workerCounters)
+			{
+				if(counter)
+					counter->forEach([this](const Mer& mer, size_t count) { _candidates[mer] += count; });
+			}
+			_workerCounters.clear();
+			return;
+		}
+
+		// whatever is left in the worker tables goes to the partitions as well
+		for(CounterPtr& counter : _workerCounters)
+		{
+			if(!counter)
+				continue;
+			if(!counter->empty())
+				flush(*counter);
+			else
+				_filteredCount += counter->filtered();
+		}
+		_workerCounters.clear();
+
+		for(auto& partition : _partitions)
+			partition->finish();
+
+		if(_config.metrics)
+		{
+			string name = "k=" + std::to_string(_k);
+			for(size_t i=0;i<_partitions.size();i++)
+				_config.metrics->table(name + " partition " + std::to_string(i), _partitions[i]->tableSize(), _partitions[i]->tableCapacity());
+			if(_shared)
+				_config.metrics->table(name + " shared", _shared->size(), _shared->capacity());
+		}
+	}
+
+	bool needsSecondPass() const {return _prefilter && _config.fixup && !_secondPass;}
+
+	/*
+	 * a prefiltered count is one below the true one (or the true one for a false positive of the filter): the top n
+	 * levels are within the top 2n+1 levels of the first pass, those are the candidates counted exactly in the second
+	 */
+	void startSecondPass()
+	{
+		vector<MerCount> candidates = collect(2 * _n + 1);
+		_candidates.reserve(candidates.size());
+		for(const MerCount& c : candidates)
+			_candidates[c.mer] = 0;
+		_workerCounters.resize(std::max(_config.numOfWorkers, (size_t)1));
+		_prefilter.reset();
+		_secondPass = true;
+	}
+
+	vector<pair<string, size_t>> results()
+	{
+		vector<pair<string, size_t>> result;
+		if(_secondPass)
+		{
+			vector<MerCount> counts;
+			counts.reserve(_candidates.size());
+			for(auto it = _candidates.begin(); it != _candidates.end(); ++it)
+				counts.push_back(MerCount(it->first, it->second));
+			TopNSelector<MerCount, MerCountOf> selector(_n);
+			selector.add(counts.begin(), counts.end());
+			for(const auto& r : selector.result())
+				result.push_back(make_pair(decode(r.mer, _k), r.count));
+			return result;
+		}
+
+		// every kmer in the tables had its first sighting taken by the prefilter
+		size_t credit = _prefilter ? 1 : 0;
+		for(const auto& r : collect(_n))
+			result.push_back(make_pair(decode(r.mer, _k), r.count + credit));
+		return result;
+	}
+
+	unsigned long long totalKmerCount() const {return _totalKmerCount;}
+	size_t numOfPartitions() const {return _partitions.size();}
+
+	/*
+	 * built from the partitions (or slices of the shared table) in parallel with the results. With the prefilter the
+	 * kmers seen once never got into the tables - every first sighting it took was the one of a distinct kmer though, so
+	 * the ones beyond the kmers in the tables are the kmers seen once (give or take the false positives of the filter)
+	 */
+	const Histogram& histogram() const
+	{
+		if(!_config.histogram)
+			throw std::runtime_error("The histogram was not asked for!");
+		return _histogram;
+	}
+
+private:
+	/*
+	 * the worker's counter ready for a block - with the shared table it writes through a writer held until leave
+	 */
+	Counter& enter(size_t worker)
+	{
+		bool shared = _shared && !_secondPass;
+		CounterPtr& counter = _workerCounters[worker];
+		if(!counter)
+		{
+			counter = CounterPtr(new Counter(_k, _n, shared ? HashTableConfig(0, 0.7f) : _config.workerConfig, _config.canonical));
+			if(_secondPass)
+				counter->setOnly(&_candidates);
+			else
+				counter->setPrefilter(_prefilter.get());
+		}
+		_blockStart[worker] = counter->counted();
+		if(shared)
+		{
+			_writers[worker].reset(new typename SharedTable::Writer(*_shared));
+			counter->setShared(_writers[worker].get());
+		}
+		return *counter;
+	}
+
+	/*
+	 * the kmers of the block since enter - a full table goes to the partitions. The table of a failed block is dropped:
+	 * it holds the kmers of a record cut short (not in counted()) and the input is not counted any further anyway
+	 */
+	size_t leave(size_t worker, bool failed = false)
+	{
+		Counter& counter = *_workerCounters[worker];
+		size_t kmers = counter.counted() - _blockStart[worker];
+		if(_writers[worker])
+		{
+			counter.setShared(nullptr);
+			_writers[worker].reset();
+		}
+		else if(failed)
+			counter.clear();
+		else if(!_secondPass && counter.size() >= _config.workerFlushThreshold)
+			flush(counter);
+		return kmers;
+	}
+
+	/*
+	 * the worker side (tables and the batches in flight) gets at most a quarter of the budget: the flush threshold is
+	 * halved until it fits. The partitions start out with room for what their share of the rest holds
+	 */
+	void fitToBudget(MemoryBudget& budget)
+	{
+		size_t limit = budget.limit() / std::max(_config.numOfStages, (size_t)1);
+		size_t workers = _workerCounters.size();
+		size_t slack = _config.workerConfig.initialSize > _config.workerFlushThreshold ?
+					   _config.workerConfig.initialSize - _config.workerFlushThreshold : 0;
+		size_t threshold = _config.workerFlushThreshold;
+		while(threshold > _minFlushThreshold && workerMemory(threshold, slack) * workers > limit / 4)
+			threshold >>= 1;
+		_config.workerFlushThreshold = threshold;
+		_config.workerConfig.initialSize = threshold + slack;
+		_reserved += workerMemory(threshold, slack) * workers;
+
+		size_t available = budget.limit() > budget.used() + _reserved ? budget.limit() - budget.used() - _reserved : 0;
+		if(available > limit)
+			available = limit;
+		size_t partitionShare = available / _config.numOfPartitions / 2;
+		size_t initialSize = _config.partitionConfig.initialSize;
+		while(initialSize && HashMap::memoryFor(initialSize, _config.partitionConfig.maxLoadFactor) > partitionShare)
+			initialSize >>= 1;
+		_config.partitionConfig.initialSize = initialSize;
+	}
+
+	/*
+	 * a worker's table and the batches its kmers are in (being built or waiting for a partition)
+	 */
+	size_t workerMemory(size_t threshold, size_t slack) const
+	{
+		return HashMap::memoryFor(threshold + slack, _config.workerConfig.maxLoadFactor) + 2 * threshold * sizeof(MerCount);
+	}
+
+	/*
+	 * the top n levels of all the partitions or of the shared table (drains them) - sets the total kmer count
+	 */
+	vector<MerCount> collect(size_t n)
+	{
+		// every kmer goes to the database on the way (with the first sighting the prefilter took)
+		unique_ptr<KmerDatabaseWriter<Mer>> database;
+		size_t numOfSlices = _shared ? std::max(_config.numOfWorkers, (size_t)1) : 0;
+		if(!_config.databasePath.empty())
+		{
+			size_t estimate = _shared ? _shared->size() : 0;
+			for(auto& partition : _partitions)
+				estimate += partition->estimatedKmers();
+			database.reset(new KmerDatabaseWriter<Mer>(_config.databasePath, _k, _config.canonical,
+													   _shared ? numOfSlices : _partitions.size(), estimate));
+			_config.databasePath.clear();
+		}
+		size_t credit = _prefilter ? 1 : 0;
+		vector<Histogram> histograms(_config.histogram ? (_shared ? numOfSlices : _partitions.size()) : 0);
+
+		// the partitions are disjoint: the top n of the whole is within the union of the top n of every partition
+		vector<vector<MerCount>> partitionResults(_partitions.size());
+		vector<thread> threads;
+		for(size_t i=0;i<_partitions.size();i++)
+		{
+			threads.push_back(thread([this, i, n, credit, &partitionResults, &database, &histograms]()
+									 {
+										KmerDatabaseWriter<Mer>* db = database.get();
+										Histogram* histogram = histograms.empty() ? nullptr : &histograms[i];
+										if(db || histogram)
+										{
+											partitionResults[i] = _partitions[i]->getResult(n, [db, histogram, i, credit](const MerCount& m)
+																							{
+																								if(db)
+																									db->add(i, m.mer, m.count + credit);
+																								if(histogram)
+																									histogram->add(m.count + credit);
+																							});
+										}
+										else
+											partitionResults[i] = _partitions[i]->getResult(n);
+										_partitions[i]->deleteSerializedFiles();
+									 }));
+		}
+		// same for the slices of the shared table - they are not sorted, the database needs them sorted
+		vector<unsigned long long> sliceTotals(numOfSlices, 0);
+		if(_shared)
+		{
+			partitionResults.resize(numOfSlices);
+			size_t range = (_shared->capacity() + numOfSlices - 1) / numOfSlices;
+			for(size_t i=0;i<numOfSlices;i++)
+			{
+				threads.push_back(thread([this, i, n, range, credit, &partitionResults, &sliceTotals, &database, &histograms]()
+										 {
+											TopNSelector<MerCount, MerCountOf> selector(n);
+											unsigned long long& total = sliceTotals[i];
+											vector<MerCount> sorted;
+											bool keep = (bool)database;
+											Histogram* histogram = histograms.empty() ? nullptr : &histograms[i];
+											_shared->forEach(i * range, (i + 1) * range, [&selector, &total, &sorted, keep, histogram, credit](const Mer& mer, size_t count)
+															 {
+																selector.add(MerCount(mer, count));
+																total += count;
+																if(keep)
+																	sorted.push_back(MerCount(mer, count));
+																if(histogram)
+																	histogram->add(count + credit);
+															 });
+											partitionResults[i] = selector.result();
+											if(database)
+											{
+												std::sort(sorted.begin(), sorted.end(), MerOrder());
+												for(const MerCount& m : sorted)
+													database->add(i, m.mer, m.count + credit);
+											}
+										 }));
+			}
+		}
+		for(thread& t : threads)
+			t.join();
+		_shared.reset();
+		if(database)
+			database->write();
+		for(const Histogram& histogram : histograms)
+			_histogram.merge(histogram);
+		if(_config.histogram && _prefilter)
+		{
+			unsigned long long distinct = _histogram.distinct();
+			if(_filteredCount > distinct)
+				_histogram.add(1, _filteredCount - distinct);
+		}
+
+		TopNSelector<MerCount, MerCountOf> selector(n);
+		for(auto& res : partitionResults)
+		{
+			selector.add(res.begin(), res.end());
+			res.clear();
+			res.reserve(0);
+		}
+
+		_totalKmerCount = _filteredCount;
+		for(auto& partition : _partitions)
+			_totalKmerCount += partition->totalKmerCount();
+		for(unsigned long long total : sliceTotals)
+			_totalKmerCount += total;
+		return selector.result();
+	}
+
+	/*
+	 * scatters the (full) table into one batch per partition and hands the batches over to the partition aggregators -
+	 * blocks while an aggregator is behind by maxPendingBatches batches
+	 */
+	void flush(Counter& counter)
+	{
+		vector<MerBatch<Mer>> batches(_partitions.size());
+		counter.extractProcessingResult(batches);
+		_filteredCount += counter.filtered();
+		counter.clear();
+		for(size_t i=0;i<_partitions.size();i++)
+			_partitions[i]->push(std::move(batches[i]));
+	}
+
+private:
+	size_t				 _k;
+	size_t				 _n;
+	CountingConfig		 _config;
+	unsigned long long	 _totalKmerCount;
+	atomic<unsigned long long> _filteredCount;	// first sightings taken by the prefilter
+	vector<CounterPtr>	 _workerCounters;	// the table each worker is counting into
+	vector<unsigned long long> _blockStart;	// the count of the worker's table when its block started
+	vector<unique_ptr<typename SharedTable::Writer>> _writers;	// of the workers in a block (shared table mode)
+	vector<PartitionPtr> _partitions;
+	unique_ptr<MemoryBudget> _ownBudget;
+	size_t				 _reserved;			// worker side bytes taken from the budget up front
+	unique_ptr<Prefilter> _prefilter;		// shared by all the worker tables
+	unique_ptr<SharedTable> _shared;		// the one table of all the workers (shared table mode)
+	bool				 _secondPass;
+	HashMap				 _candidates;		// second pass: the kmers counted and their exact counts
+	Histogram			 _histogram;
+
+	static const size_t _minFlushThreshold = 1<<10;
+};
+
+
+/*
+ * Approximate counting: the workers still pre-aggregate into their KmerCounter, but a full table goes into the
+ * worker's Count-Min sketch (and top n candidates) instead of the partitions. The sketches are merged once counting is
+ * done - memory stays at the sketch budget whatever the input and nothing is spilled.
+ */
+template<class Mer>
+class SketchCountingStage : public CountingStageBase
+{
+	using Counter = KmerCounter<Mer>;
+	using Accumulator = SketchAccumulator<Mer>;
+	using MerCount = mer_count<Mer>;
+
+	struct Worker
+	{
+		Worker(size_t k, size_t n, const CountingConfig& config, size_t width, size_t depth, size_t capacity) :
+																				counter(k, n, config.workerConfig, config.canonical),
+																				accumulator(width, depth, capacity),
+																				blockStart(0) {}
+		Counter		counter;
+		Accumulator accumulator;
+		unsigned long long blockStart;	// the count of the counter when the block started
+	};
+	using WorkerPtr = unique_ptr<Worker>;
+public:
+	SketchCountingStage(size_t k, size_t n, const CountingConfig& config) : _k(k),
+																			_n(n),
+																			_config(config),
+																			_collector(n, k)
+	{
+		Accumulator::Sketch::shapeFromBudget(_config.sketchMemory, _config.sketchError, _width, _depth);
+		_workers.resize(std::max(_config.numOfWorkers, (size_t)1));
+		_reserved = _width * _depth * sizeof(typename Accumulator::Sketch::counter_type) * _workers.size();
+		_capacity = _n * _candidatesPerLevel;
+		if(_capacity < _minCandidates)
+			_capacity = _minCandidates;
+		if(_config.budget)
+		{
+			fitToBudget(*_config.budget);
+			_config.budget->reserve(_reserved);
+		}
+	}
+
+	~SketchCountingStage()
+	{
+		if(_config.budget)
+			_config.budget->release(_reserved);
+	}
+
+	void start() {}
+
+	size_t count(size_t worker, const BlockTask& task)
+	{
+		enter(worker).count(task.segments, task.next);
+		return leave(worker);
+	}
+
+	CodeSink& beginBlock(size_t worker) {return enter(worker);}
+	size_t endBlock(size_t worker) {return leave(worker);}
+
+	void finish()
+	{
+		for(WorkerPtr& w : _workers)
+		{
+			if(!w)
+				continue;
+			flush(*w);
+			_collector.merge(w->accumulator);
+			w.reset();
+		}
+	}
+
+	vector<pair<string, size_t>> results()
+	{
+		vector<pair<string, size_t>> result;
+		for(const auto& r : _collector.getResult())
+			result.push_back(make_pair(decode(r.mer, _k), r.count));
+		return result;
+	}
+
+	unsigned long long totalKmerCount() const {return _collector.totalKmerCount();}
+	size_t numOfPartitions() const {return 0;}
+
+	size_t estimate(const string& kmer) const
+	{
+		if(kmer.size() != _k)
+			throw std::runtime_error("The kmer to estimate has to be of length k!");
+		Mer mer = encode<Mer>(kmer.c_str(), _k);
+		return _collector.estimate(_config.canonical ? canonical(mer, _k) : mer);
+	}
+
+	unsigned long long errorBound() const {return _collector.errorBound();}
+	double errorConfidence() const {return _collector.confidence();}
+
+private:
+	Counter& enter(size_t worker)
+	{
+		WorkerPtr& w = _workers[worker];
+		if(!w)
+			w = WorkerPtr(new Worker(_k, _n, _config, _width, _depth, _capacity));
+		w->blockStart = w->counter.counted();
+		return w->counter;
+	}
+
+	size_t leave(size_t worker)
+	{
+		Worker& w = *_workers[worker];
+		size_t kmers = w.counter.counted() - w.blockStart;
+		if(w.counter.size() >= _config.workerFlushThreshold)
+			flush(w);
+		return kmers;
+	}
+
+	/*
+	 * as in CountingStage: the worker tables get at most a quarter of the stage's share of the budget - the flush
+	 * threshold is halved until they fit
+	 */
+	void fitToBudget(const MemoryBudget& budget)
+	{
+		size_t limit = budget.limit() / std::max(_config.numOfStages, (size_t)1);
+		size_t slack = _config.workerConfig.initialSize > _config.workerFlushThreshold ?
+					   _config.workerConfig.initialSize - _config.workerFlushThreshold : 0;
+		size_t threshold = _config.workerFlushThreshold;
+		while(threshold > _minFlushThreshold && workerMemory(threshold + slack) * _workers.size() > limit / 4)
+			threshold >>= 1;
+		_config.workerFlushThreshold = threshold;
+		_config.workerConfig.initialSize = threshold + slack;
+		_reserved += workerMemory(threshold + slack) * _workers.size();
+	}
+
+	/*
+	 * a worker's table and its top n candidates
+	 */
+	size_t workerMemory(size_t tableSize) const
+	{
+		return Counter::HashMap::memoryFor(tableSize, _config.workerConfig.maxLoadFactor) + _capacity * sizeof(MerCount);
+	}
+
+	void flush(Worker& w)
+	{
+		Accumulator& acc = w.accumulator;
+		w.counter.forEach([&acc](const Mer& mer, size_t count) { acc.add(mer, count); });
+		w.counter.clear();
+	}
+
+private:
+	static const size_t _candidatesPerLevel = 64;
+	static const size_t _minCandidates = 4096;
+	static const size_t _minFlushThreshold = 1<<10;
+
+	size_t							 _k;
+	size_t							 _n;
+	CountingConfig					 _config;
+	size_t							 _width;		// shape of the worker sketches
+	size_t							 _depth;
+	size_t							 _capacity;		// top n candidates kept per worker
+	size_t							 _reserved;		// bytes of the sketches and the worker tables taken from the budget
+	ApproximateResultCollector<Mer>	 _collector;
+	vector<WorkerPtr>				 _workers;
+};
+
+
+template<class Mer>
+unique_ptr<CountingStageBase> makeCountingStageFor(size_t k, size_t n, const CountingConfig& config)
+{
+	if(config.approximate)
+		return unique_ptr<CountingStageBase>(new SketchCountingStage<Mer>(k, n, config));
+	return unique_ptr<CountingStageBase>(new CountingStage<Mer>(k, n, config));
+}
+
+/*
+ * the counting stage with the narrowest key that fits k - the wider the key the bigger every table entry, spill record
+ * and comparison, so small k should not pay for the long ones
+ */
+inline unique_ptr<CountingStageBase> makeCountingStage(size_t k, size_t n, const CountingConfig& config)
+{
+	if(k == 0)
+		throw std::runtime_error("Kmer length has to be positive!");
+	if(k <= mer32::maxK)
+		return makeCountingStageFor<mer32>(k, n, config);
+	if(k <= mer64::maxK)
+		return makeCountingStageFor<mer64>(k, n, config);
+	if(k <= mer128::maxK)
+		return makeCountingStageFor<mer128>(k, n, config);
+	if(k <= mer256::maxK)
+		return makeCountingStageFor<mer256>(k, n, config);
+	throw std::runtime_error("Kmer length too big!");
+}
+
+}
+
+#endif
@@ -9,6 +9,25 @@
 #include <memory>
 #include <queue>
 #include <mutex>
+#include <stdexcept>
+#include <algorithm>
+
+#include <vector>
+#include <future>
+#include <deque>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <set>
+
+#include <zlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <WorkerPool.h>
+#include <Metrics.h>
 
 namespace io
 {
@@ -41,6 +60,8 @@ public:
 	inline size_t	   getAllocSize() const {return _allocated;}
 	inline void		   setEndOfStream() {_endOfStream = true;}
 	inline bool		   isEndofStream() const {return _endOfStream;}
+	inline size_t	   getSequence() const {return _sequence;}
+	inline void		   setSequence(size_t sequence) {_sequence = sequence;}
 
 	
 	
@@ -52,8 +73,75 @@ private:
 	size_t _allocated;
 	size_t _len;
 	bool	_endOfStream = false;
+	size_t	_sequence = 0;	// position of the block in the stream
+};
+
+/*
+ * A fixed number of buffers of the same size in one allocation, every buffer starting on a cache line. acquire blocks
+ * while all of them are out - that is what holds the reader back once it gets ahead of the counting. The free ones are
+ * a stack so the buffer given back last (likely still in the cache) goes out first.
+ */
+class BufferPool
+{
+	struct Free
+	{
+		void operator()(char* p) const {free(p);}
+	};
+public:
+	BufferPool() : _bufferSize(0), _numOfBuffers(0) {}
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+	/*
+	 * drops the buffers there were - none of them may be out
+	 */
+	void allocate(size_t numOfBuffers, size_t bufferSize)
+	{
+		std::unique_lock<mutex> lock(_mutex);
+		_bufferSize = (bufferSize + _alignment - 1) / _alignment * _alignment;
+		_numOfBuffers = numOfBuffers ? numOfBuffers : 1;
+		void* memory = nullptr;
+		if(posix_memalign(&memory, _alignment, _numOfBuffers * _bufferSize) != 0)
+			throw std::runtime_error("Could not allocate the input buffers!");
+		_memory.reset(static_cast<char*>(memory));
+		_free.clear();
+		for(size_t i=_numOfBuffers;i>0;i--)
+			_free.push_back(_memory.get() + (i - 1) * _bufferSize);
+	}
+
+	size_t bufferSize() const {return _bufferSize;}
+	size_t size() const {return _numOfBuffers;}
+
+	char* acquire()
+	{
+		std::unique_lock<mutex> lock(_mutex);
+		while(_free.empty())
+			_condvarFree.wait(lock);
+		char* buffer = _free.back();
+		_free.pop_back();
+		return buffer;
+	}
+
+	void release(const char* buffer)
+	{
+		std::unique_lock<mutex> lock(_mutex);
+		_free.push_back(const_cast<char*>(buffer));
+		_condvarFree.notify_one();
+	}
+
+private:
+	static const size_t _alignment = 64;
+
+	size_t			   _bufferSize;
+	size_t			   _numOfBuffers;
+	std::unique_ptr<char, Free> _memory;
+	std::vector<char*> _free;
+	mutex			   _mutex;
+	condition_variable _condvarFree;
 };
 
+
 class FileReader
 {
 public:
@@ -63,23 +151,62 @@ public:
 		_fileSize = _stream.tellg();
 		_stream.seekg(0, _stream.beg);
 	}
-	~FileReader()
+	virtual ~FileReader()
 	{
-		_ioThread.join();
+		joinReader();
 	}
 	
 	size_t blocksize() const {return _blockSize;}
 	void   blocksize(size_t size) {_blockSize = size;}
 	const string& filepath() const {return _filePath;}
-	size_t filesize() const {return _fileSize;}
+	size_t filesize() const {return _fileSize;}	// on disk - compressed for the compressed readers
+	virtual bool compressed() const {return false;}
+	// size of the buffers of the blocks and how many of them may be out on the reader's account (being read, decoded or
+	// waiting for the ones before them)
+	virtual size_t bufferSize() const {return _blockSize;}
+	virtual size_t buffersInFlight() const {return 1;}
 	
 
 	/*
-	 * Async reading into the queue - retrieve using the getNextBlock function
+	 * Async reading into the queue - retrieve using the getNextBlock function. Every block has its sequence number, the
+	 * end of stream flag is on the last one by number (with a parallel reader not necessarily the last one to come).
+	 * The blocks are numOfBuffers buffers (at least buffersInFlight and one more) of a BufferPool going round: the
+	 * consumer gives every block back by recycle once done with it, the reader waits for that when all of them are out. The readers that can decode in parallel
+	 * submit their work to the pool (if given). metrics: the reads and the decompression are timed into the read stage,
+	 * the waits for a free buffer into read_wait, and the depth of the queue is sampled on every push
+	 *
+	 * If reading fails (e.g. a corrupt compressed file) the reader thread stops and the error takes the place of the
+	 * blocks still to come: getNextBlock throws it once the blocks before it are taken, every time it is called from
+	 * then on.
+	 */
+	void startReadingBlocks(kmers::WorkerPool* pool = nullptr, kmers::Metrics* metrics = nullptr, size_t numOfBuffers = 0)
+	{
+		_buffers.allocate(std::max(numOfBuffers, buffersInFlight() + 1), bufferSize());
+		_pool = pool;
+		_metrics = metrics;
+		_error = nullptr;
+		_ioThread = thread([this]()
+						   {
+								try
+								{
+									doRead();
+								}
+								catch(...)
+								{
+									pushError(std::current_exception());
+								}
+						   });
+	}
+
+	/*
+	 * returns once the reader thread is done (the end of stream block or the error is in the queue) - throws the error
+	 * the reader stopped with
 	 */
-	void startReadingBlocks()
+	void waitReading()
 	{
-		_ioThread = thread(&FileReader::doRead, this);
+		joinReader();
+		if(_error)
+			std::rethrow_exception(_error);
 	}
 
 	void getNextBlock(InputBuffer& buffer)
@@ -87,16 +214,37 @@ public:
 		std::unique_lock<mutex> lock(_mutexBufferQueue);
 		while(_bufferQueue.empty())
 			_condvarQueue.wait(lock);
+		// the error stays at the front - nothing comes after it
+		if(_error && _bufferQueue.size() == 1 && !_bufferQueue.front().getBuffer())
+			std::rethrow_exception(_error);
 		buffer = _bufferQueue.front();
 		_bufferQueue.pop();
 	}
 
+	void recycle(const char* buffer) {_buffers.release(buffer);}
+
 
 protected:
+	/*
+	 * the read stage only gets the reads and the decompression - the waits for a free buffer are a stage of their own
+	 */
+	kmers::StageMetrics* readStage() const {return _metrics ? &_metrics->read : nullptr;}
+
+	InputBuffer nextBuffer()
+	{
+		kmers::StageTimer timer(_metrics ? &_metrics->readWait : nullptr);
+		InputBuffer buf(_buffers.acquire(), _buffers.bufferSize());
+		buf.setLen(0);
+		return buf;
+	}
+
 	InputBuffer readNextBlock()
 	{
-		InputBuffer buf(_blockSize);
-		_stream.read(buf.getBuffer(), _blockSize);
+		InputBuffer buf = nextBuffer();
+		{
+			kmers::StageTimer timer(readStage());
+			_stream.read(buf.getBuffer(), _blockSize);
+		}
 		
 		if(_stream)
 		{
@@ -111,7 +259,7 @@ protected:
 		return buf;
 	}
 	
-	void doRead()
+	virtual void doRead()
 	{
 		while(true)
 		{
@@ -127,15 +275,46 @@ protected:
 
 	void pushToQueue(const InputBuffer& buffer)
 	{
+		pushToQueue(buffer, _numOfPushed++);
+	}
+
+	void pushToQueue(InputBuffer buffer, size_t sequence)
+	{
+		buffer.setSequence(sequence);
 		std::unique_lock<mutex> lock(_mutexBufferQueue);
 		_bufferQueue.push(buffer);
+		if(_metrics)
+		{
+			_metrics->read.bytes.fetch_add(buffer.getLen(), std::memory_order_relaxed);
+			_metrics->inputQueue.sample(_bufferQueue.size());
+		}
 		_condvarQueue.notify_one();
 	}
 
+	void joinReader()
+	{
+		if(_ioThread.joinable())
+			_ioThread.join();
+	}
+
+private:
+	/*
+	 * the marker of the error: a block without a buffer, the last one in the queue
+	 */
+	void pushError(std::exception_ptr error)
+	{
+		std::unique_lock<mutex> lock(_mutexBufferQueue);
+		_error = error;
+		_bufferQueue.push(InputBuffer());
+		_condvarQueue.notify_one();
+	}
 
 
 protected:
+	kmers::WorkerPool* _pool = nullptr;
+	kmers::Metrics*	   _metrics = nullptr;
 	bool 	  _finishedReadingFile = false;
+	size_t	  _numOfPushed = 0;
 	ifstream _stream;
 	size_t	 _fileSize;
 	string   _filePath;
@@ -143,10 +322,518 @@ protected:
 	mutex	 _mutexBufferQueue;
 	condition_variable _condvarQueue;
 	queue<InputBuffer> _bufferQueue;
+	std::exception_ptr _error;		// the reader thread failed with
+	BufferPool _buffers;
 	thread	 _ioThread;
 };
 
 
+/*
+ * Plain files on storage that only gets to its bandwidth with several requests in flight (NVMe, striped RAID):
+ * numOfThreads I/O threads pread the blocks at their offsets (block i at i * blocksize) and queue them as they complete,
+ * out of order and numbered by their position. A block is only started while it is less than maxAhead blocks past the
+ * oldest one still being read, so the consumer never holds back more than that many waiting for a slow one.
+ */
+class PreadFileReader : public FileReader
+{
+public:
+	PreadFileReader(const std::string& path, size_t blockSize=1<<15, size_t numOfThreads=4, size_t maxAhead=0) :
+																			 FileReader(path, blockSize),
+																			 _numOfThreads(numOfThreads ? numOfThreads : 1),
+																			 _maxAhead(maxAhead ? maxAhead : 4 * _numOfThreads),
+																			 _fd(open(path.c_str(), O_RDONLY)),
+																			 _nextBlock(0)
+	{
+		if(_fd < 0)
+			throw std::runtime_error("Could not open " + path);
+	}
+	~PreadFileReader()
+	{
+		joinReader();
+		close(_fd);
+	}
+
+	// the blocks being read and the ones read ahead of a slow one
+	size_t buffersInFlight() const {return _numOfThreads + _maxAhead;}
+
+protected:
+	void doRead()
+	{
+		// an empty file still gets its (empty) end of stream block
+		size_t numOfBlocks = std::max<size_t>((_fileSize + _blockSize - 1) / _blockSize, 1);
+		std::vector<thread> threads;
+		for(size_t t=1;t<_numOfThreads;t++)
+			threads.push_back(thread([this, numOfBlocks]() {readBlocks(numOfBlocks);}));
+		readBlocks(numOfBlocks);
+		for(thread& t : threads)
+			t.join();
+		if(_readError)
+			std::rethrow_exception(_readError);
+		_finishedReadingFile = true;
+	}
+
+private:
+	/*
+	 * the first error stops the others from starting any more blocks - doRead throws it once they are all done
+	 */
+	void readBlocks(size_t numOfBlocks)
+	{
+		try
+		{
+			readBlocksUntilFailed(numOfBlocks);
+		}
+		catch(...)
+		{
+			std::unique_lock<mutex> lock(_mutexWindow);
+			if(!_readError)
+				_readError = std::current_exception();
+			_condvarWindow.notify_all();
+		}
+	}
+
+	void readBlocksUntilFailed(size_t numOfBlocks)
+	{
+		while(true)
+		{
+			size_t block;
+			{
+				std::unique_lock<mutex> lock(_mutexWindow);
+				_condvarWindow.wait(lock, [this, numOfBlocks]()
+									{
+										return _readError || _nextBlock >= numOfBlocks || _reading.empty() || _nextBlock < *_reading.begin() + _maxAhead;
+									});
+				if(_readError || _nextBlock >= numOfBlocks)
+					return;
+				block = _nextBlock++;
+				_reading.insert(block);
+			}
+			size_t offset = block * _blockSize;
+			InputBuffer buf = nextBuffer();
+			buf.setLen(std::min(_blockSize, _fileSize - offset));
+			try
+			{
+				readAt(buf.getBuffer(), buf.getLen(), offset);
+			}
+			catch(...)
+			{
+				recycle(buf.getBuffer());
+				throw;
+			}
+			if(block + 1 == numOfBlocks)
+				buf.setEndOfStream();
+			pushToQueue(buf, block);
+			{
+				std::unique_lock<mutex> lock(_mutexWindow);
+				_reading.erase(block);
+			}
+			_condvarWindow.notify_all();
+		}
+	}
+
+	void readAt(char* to, size_t len, size_t offset)
+	{
+		kmers::StageTimer timer(readStage());
+		while(len)
+		{
+			ssize_t got = pread(_fd, to, len, offset);
+			if(got < 0 && errno == EINTR)
+				continue;
+			if(got <= 0)
+				throw std::runtime_error("Could not read " + _filePath);
+			to += got;
+			len -= got;
+			offset += got;
+		}
+	}
+
+private:
+	size_t			 _numOfThreads;
+	size_t			 _maxAhead;
+	int				 _fd;
+	mutex			 _mutexWindow;
+	condition_variable _condvarWindow;
+	size_t			 _nextBlock;
+	std::set<size_t> _reading;		// blocks being read
+	std::exception_ptr _readError;	// the first one of the threads failed with
+};
+
+
+/*
+ * Streams a gzip file (any number of members) through zlib on the reader thread - the queue gets the decompressed data
+ * in blocks of blocksize
+ */
+class GzipFileReader : public FileReader
+{
+public:
+	GzipFileReader(const std::string& path, size_t blockSize=1<<15) : FileReader(path, blockSize) {}
+	~GzipFileReader()
+	{
+		joinReader();
+	}
+
+	bool compressed() const {return true;}
+
+protected:
+	void doRead()
+	{
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		// 15+32: gzip or zlib header detected automatically
+		if(inflateInit2(&zs, 15 + 32) != Z_OK)
+			throw std::runtime_error("Could not init zlib!");
+		std::vector<char> in(_inputChunk);
+		InputBuffer out = nextBuffer();
+		bool eof = false;
+		auto fill = [&]()
+		{
+			kmers::StageTimer timer(readStage());
+			_stream.read(in.data(), in.size());
+			zs.next_in = reinterpret_cast<Bytef*>(in.data());
+			zs.avail_in = _stream.gcount();
+			eof = !_stream;
+		};
+		while(true)
+		{
+			if(zs.avail_in == 0 && !eof)
+				fill();
+			zs.next_out = reinterpret_cast<Bytef*>(out.getBuffer() + out.getLen());
+			zs.avail_out = _blockSize - out.getLen();
+			int ret;
+			{
+				kmers::StageTimer timer(readStage());
+				ret = inflate(&zs, Z_NO_FLUSH);
+			}
+			out.setLen(_blockSize - zs.avail_out);
+			if(ret == Z_STREAM_END)
+			{
+				// a member can end right at the end of the input read so far: only the next read tells whether
+				// another one follows
+				if(zs.avail_in == 0 && !eof)
+					fill();
+				if(zs.avail_in == 0)
+					break;
+				// concatenated members (e.g. bgzf) - go on with the next one
+				inflateReset(&zs);
+			}
+			else if(ret == Z_BUF_ERROR && eof && zs.avail_in == 0)
+			{
+				inflateEnd(&zs);
+				recycle(out.getBuffer());
+				throw std::runtime_error("Truncated gzip file " + _filePath);
+			}
+			else if(ret != Z_OK && ret != Z_BUF_ERROR)
+			{
+				inflateEnd(&zs);
+				recycle(out.getBuffer());
+				throw std::runtime_error("Corrupt gzip file " + _filePath);
+			}
+			if(out.getLen() == _blockSize)
+			{
+				pushToQueue(out);
+				out = nextBuffer();
+			}
+		}
+		inflateEnd(&zs);
+		out.setEndOfStream();
+		pushToQueue(out);
+		_finishedReadingFile = true;
+	}
+
+	static const size_t _inputChunk = 1 << 20;
+};
+
+
+/*
+ * BGZF (blocked gzip, bgzip/samtools): the file is a series of independent gzip members of at most 64KB each, every
+ * one telling its own compressed size in the header. The reader thread only cuts the file into the members, they are
+ * inflated in parallel on the pool and put into the queue in file order (one buffer per member). At most maxInFlight
+ * members are being decoded at a time. Without a pool the members are decoded on the reader thread.
+ */
+class BgzfFileReader : public FileReader
+{
+	using Member = std::vector<char>;
+public:
+	BgzfFileReader(const std::string& path, size_t blockSize=1<<15, size_t maxInFlight=64) : FileReader(path, blockSize),
+																							  _maxInFlight(maxInFlight ? maxInFlight : 1)
+	{
+	}
+	~BgzfFileReader()
+	{
+		joinReader();
+	}
+
+	bool compressed() const {return true;}
+	// a member decodes to at most 64KB, the reader holds the members being decoded
+	size_t bufferSize() const {return std::max(_blockSize, _maxMemberSize);}
+	size_t buffersInFlight() const {return _maxInFlight + 1;}
+
+	/*
+	 * the first member of a bgzf file has the 'BC' extra subfield
+	 */
+	static bool isBgzf(const unsigned char* header, size_t len)
+	{
+		if(len < 18 || header[0] != 0x1f || header[1] != 0x8b || header[2] != 8 || !(header[3] & 4))
+			return false;
+		size_t xlen = header[10] | (header[11] << 8);
+		for(size_t i = 12; i + 4 <= std::min(len, 12 + xlen); )
+		{
+			size_t slen = header[i+2] | (header[i+3] << 8);
+			if(header[i] == 'B' && header[i+1] == 'C' && slen == 2)
+				return true;
+			i += 4 + slen;
+		}
+		return false;
+	}
+
+protected:
+	void doRead()
+	{
+		std::deque<std::future<InputBuffer>> inFlight;
+		try
+		{
+			readMembers(inFlight);
+		}
+		catch(...)
+		{
+			// the decoding tasks on the pool still write into the buffers (and look at the reader)
+			// (the member that failed took its buffer back itself)
+			for(auto& decoded : inFlight)
+			{
+				try
+				{
+					if(decoded.valid())
+						recycle(decoded.get().getBuffer());
+				}
+				catch(...)
+				{
+				}
+			}
+			throw;
+		}
+		InputBuffer last = nextBuffer();
+		last.setEndOfStream();
+		pushToQueue(last);
+		_finishedReadingFile = true;
+	}
+
+private:
+	/*
+	 * cuts the file into members and decodes them - hands over the decoded ones in file order
+	 */
+	void readMembers(std::deque<std::future<InputBuffer>>& inFlight)
+	{
+		Member member;
+		while(readMember(member))
+		{
+			InputBuffer out = nextBuffer();
+			std::shared_ptr<std::promise<InputBuffer>> decoded(new std::promise<InputBuffer>());
+			inFlight.push_back(decoded->get_future());
+			if(_pool)
+			{
+				std::shared_ptr<Member> m(new Member());
+				m->swap(member);
+				_pool->submit([this, m, out, decoded](size_t) {decode(*m, out, *decoded);});
+			}
+			else
+				decode(member, out, *decoded);
+			// hand over in file order
+			while(inFlight.size() >= _maxInFlight || (!inFlight.empty() && ready(inFlight.front())))
+			{
+				pushDecoded(inFlight.front().get());
+				inFlight.pop_front();
+			}
+		}
+		while(!inFlight.empty())
+		{
+			pushDecoded(inFlight.front().get());
+			inFlight.pop_front();
+		}
+	}
+
+	/*
+	 * reads the next member (header + compressed data + footer) - false at the end of the file
+	 */
+	bool readMember(Member& member)
+	{
+		kmers::StageTimer timer(readStage());
+		unsigned char header[12];
+		_stream.read(reinterpret_cast<char*>(header), sizeof(header));
+		if(_stream.gcount() == 0)
+			return false;
+		if(_stream.gcount() != sizeof(header) || header[0] != 0x1f || header[1] != 0x8b || !(header[3] & 4))
+			throw std::runtime_error("Corrupt bgzf file " + _filePath);
+		size_t xlen = header[10] | (header[11] << 8);
+		std::vector<unsigned char> extra(xlen);
+		_stream.read(reinterpret_cast<char*>(extra.data()), xlen);
+		size_t bsize = 0;
+		for(size_t i = 0; i + 4 <= xlen; )
+		{
+			size_t slen = extra[i+2] | (extra[i+3] << 8);
+			if(extra[i] == 'B' && extra[i+1] == 'C' && slen == 2 && i + 6 <= xlen)
+				bsize = (extra[i+4] | (extra[i+5] << 8)) + 1;
+			i += 4 + slen;
+		}
+		if(!_stream || bsize < sizeof(header) + xlen + 8)
+			throw std::runtime_error("Corrupt bgzf file " + _filePath);
+		// what is left: the deflate data, crc32 and isize
+		member.resize(bsize - sizeof(header) - xlen);
+		_stream.read(member.data(), member.size());
+		if((size_t)_stream.gcount() != member.size())
+			throw std::runtime_error("Truncated bgzf file " + _filePath);
+		return true;
+	}
+
+	/*
+	 * into out (a buffer of the pool) - given back to the pool if it fails
+	 */
+	void decode(const Member& member, InputBuffer out, std::promise<InputBuffer>& result)
+	{
+		try
+		{
+			kmers::StageTimer timer(readStage());
+			const unsigned char* footer = reinterpret_cast<const unsigned char*>(member.data() + member.size() - 8);
+			uint32_t crc = footer[0] | (footer[1] << 8) | (footer[2] << 16) | ((uint32_t)footer[3] << 24);
+			size_t isize = footer[4] | (footer[5] << 8) | (footer[6] << 16) | ((uint32_t)footer[7] << 24);
+			if(isize > out.getAllocSize())
+				throw std::runtime_error("Corrupt bgzf block in " + _filePath);
+			z_stream zs;
+			memset(&zs, 0, sizeof(zs));
+			if(inflateInit2(&zs, -15) != Z_OK)
+				throw std::runtime_error("Could not init zlib!");
+			zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(member.data()));
+			zs.avail_in = member.size() - 8;
+			zs.next_out = reinterpret_cast<Bytef*>(out.getBuffer());
+			zs.avail_out = isize;
+			int ret = inflate(&zs, Z_FINISH);
+			inflateEnd(&zs);
+			if(ret != Z_STREAM_END || zs.avail_out != 0 ||
+			   crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(out.getBuffer()), isize) != crc)
+				throw std::runtime_error("Corrupt bgzf block in " + _filePath);
+			out.setLen(isize);
+			result.set_value(out);
+		}
+		catch(...)
+		{
+			recycle(out.getBuffer());
+			result.set_exception(std::current_exception());
+		}
+	}
+
+	static bool ready(std::future<InputBuffer>& f)
+	{
+		return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+
+	void pushDecoded(const InputBuffer& buffer)
+	{
+		// the empty end of file marker member is not worth a block
+		if(buffer.getLen())
+			pushToQueue(buffer);
+		else
+			recycle(buffer.getBuffer());
+	}
+
+private:
+	static const size_t _maxMemberSize = 1 << 16;
+
+	size_t _maxInFlight;
+};
+
+
+/*
+ * the reader fitting the file: bgzf, gzip (by the magic bytes) or plain - read by ioThreads threads with pread if more
+ * than one is given
+ */
+inline unique_ptr<FileReader> openFileReader(const std::string& path, size_t blockSize=1<<15, size_t ioThreads=1)
+{
+	unsigned char header[64] = {0};
+	ifstream probe(path, ifstream::binary);
+	probe.read(reinterpret_cast<char*>(header), sizeof(header));
+	size_t len = probe.gcount();
+	if(BgzfFileReader::isBgzf(header, len))
+		return unique_ptr<FileReader>(new BgzfFileReader(path, blockSize));
+	if(len >= 2 && header[0] == 0x1f && header[1] == 0x8b)
+		return unique_ptr<FileReader>(new GzipFileReader(path, blockSize));
+	if(ioThreads > 1)
+		return unique_ptr<FileReader>(new PreadFileReader(path, blockSize, ioThreads));
+	return unique_ptr<FileReader>(new FileReader(path, blockSize));
+}
+
+
+/*
+ * Read only private mapping of the whole file - zero copy alternative of FileReader: the consumer reads the blocks
+ * straight from the mapping. The kernel is told that we go through it sequentially and the consumer can ask for read ahead
+ * of the window it is about to hand out with willNeed.
+ */
+class MappedFile
+{
+public:
+	MappedFile(const std::string& path) : _fd(-1), _data(nullptr), _size(0)
+	{
+		_fd = ::open(path.c_str(), O_RDONLY);
+		if(_fd < 0)
+			throw std::runtime_error("Could not open " + path);
+		struct stat st;
+		if(fstat(_fd, &st) != 0)
+		{
+			::close(_fd);
+			throw std::runtime_error("Could not stat " + path);
+		}
+		_size = st.st_size;
+		if(_size)
+		{
+			void* addr = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+			if(addr == MAP_FAILED)
+			{
+				::close(_fd);
+				throw std::runtime_error("Could not mmap " + path);
+			}
+			_data = static_cast<const char*>(addr);
+			madvise(addr, _size, MADV_SEQUENTIAL);
+		}
+	}
+	~MappedFile()
+	{
+		if(_data)
+			munmap(const_cast<char*>(_data), _size);
+		if(_fd >= 0)
+			::close(_fd);
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data() const {return _data;}
+	size_t		size() const {return _size;}
+
+	/*
+	 * the pages are going to be touched in no particular order (lookups) - no read ahead
+	 */
+	void adviseRandom() const
+	{
+		if(_data)
+			madvise(const_cast<char*>(_data), _size, MADV_RANDOM);
+	}
+
+	/*
+	 * hint the kernel to start paging in [offset, offset+len) - the range is widened to page boundaries
+	 */
+	void willNeed(size_t offset, size_t len) const
+	{
+		if(offset >= _size || !len)
+			return;
+		static const size_t pageSize = sysconf(_SC_PAGESIZE);
+		size_t begin = offset - offset % pageSize;
+		size_t end = std::min(_size, offset + len);
+		madvise(const_cast<char*>(_data) + begin, end - begin, MADV_WILLNEED);
+	}
+
+private:
+	int			_fd;
+	const char* _data;
+	size_t		_size;
+};
+
 
 }
 
@@ -9,6 +9,8 @@
 #define FILESERIALIZER_H_
 
 #include <fstream>
+#include <vector>
+#include <algorithm>
 
 #include <Serializer.h>
 
@@ -16,6 +18,7 @@
 
 using std::ofstream;
 using std::ifstream;
+using std::vector;
 
 namespace serialization
 {
@@ -99,6 +102,51 @@ public:
 		obj.deserialize(Encoded(buff, totalSize));
 	}
 };
+/*
+ * Streams the records of a written run back block by block instead of reading the whole file into memory -
+ * meant for merging many (sorted) runs at once.
+ * valid/current/advance: cursor style access, current is only valid while valid() is true
+ */
+template<class Record>
+class RunReader
+{
+public:
+	RunReader(const SerializationInfo& info, size_t blockRecords = (1 << 15) / sizeof(Record) + 1) :
+																		_f(info.filename.c_str(), std::ios_base::binary),
+																		_remaining(info.byteCount / sizeof(Record)),
+																		_buffer(blockRecords),
+																		_pos(0),
+																		_len(0)
+	{
+		fill();
+	}
+
+	inline bool			 valid() const {return _pos < _len;}
+	inline const Record& current() const {return _buffer[_pos];}
+
+	inline void advance()
+	{
+		if(++_pos == _len)
+			fill();
+	}
+
+private:
+	void fill()
+	{
+		_pos = 0;
+		_len = std::min(_remaining, _buffer.size());
+		if(_len)
+			_f.read(reinterpret_cast<char*>(_buffer.data()), _len * sizeof(Record));
+		_remaining -= _len;
+	}
+
+private:
+	ifstream	   _f;
+	size_t		   _remaining;
+	vector<Record> _buffer;
+	size_t		   _pos;
+	size_t		   _len;
+};
 
 }
 
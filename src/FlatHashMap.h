@@ -0,0 +1,228 @@
+#ifndef FLATHASHMAP_H_
+#define FLATHASHMAP_H_
+
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+namespace kmers
+{
+
+/**
+ * Open addressing hash table with linear probing. Keys and values are stored inline in one contiguous slot array
+ * (no node per element, no pointer chasing), the capacity is always a power of two and the table grows by doubling
+ * once the max load factor is reached. Only the subset of the unordered_map interface we need is provided.
+ *
+ * Every table scrambles the hash with its own seed before taking the high bits as the slot. Otherwise copying one table
+ * into another in slot order (merging the counter tables into the database) inserts the keys sorted by their slot,
+ * the destination only ever sees one corner of the hash space and linear probing degrades into one huge cluster.
+ * No erase - the counting tables only ever grow and get cleared.
+ */
+template<class Key, class Value, class Hash>
+class FlatHashMap
+{
+public:
+	using value_type = std::pair<Key, Value>;
+
+private:
+	struct Slot
+	{
+		Slot() : used(false) {}
+		value_type kv;
+		bool	   used;
+	};
+
+	template<class SlotPtr, class Ref, class Ptr>
+	class basic_iterator : public std::iterator<std::forward_iterator_tag, value_type>
+	{
+	public:
+		basic_iterator() : _curr(nullptr), _end(nullptr) {}
+		basic_iterator(SlotPtr curr, SlotPtr end) : _curr(curr), _end(end) {skip();}
+		// iterator -> const_iterator
+		template<class S, class R, class P>
+		basic_iterator(const basic_iterator<S, R, P>& other) : _curr(other._curr), _end(other._end) {}
+		Ref operator*() const {return _curr->kv;}
+		Ptr operator->() const {return &(_curr->kv);}
+		basic_iterator& operator++() {++_curr; skip(); return *this;}
+		basic_iterator operator++(int) {basic_iterator tmp(*this); ++(*this); return tmp;}
+		bool operator==(const basic_iterator& other) const {return _curr == other._curr;}
+		bool operator!=(const basic_iterator& other) const {return _curr != other._curr;}
+	private:
+		template<class, class, class> friend class basic_iterator;
+		void skip()
+		{
+			while(_curr != _end && !_curr->used)
+				++_curr;
+		}
+		SlotPtr _curr;
+		SlotPtr _end;
+	};
+
+public:
+	using iterator = basic_iterator<Slot*, value_type&, value_type*>;
+	using const_iterator = basic_iterator<const Slot*, const value_type&, const value_type*>;
+
+	FlatHashMap() : _size(0), _mask(0), _shift(0), _growAt(0), _maxLoadFactor(0.7f), _seed(nextSeed()) {}
+
+	iterator begin() {return iterator(_slots.data(), _slots.data() + _slots.size());}
+	iterator end() {return iterator(_slots.data() + _slots.size(), _slots.data() + _slots.size());}
+	const_iterator begin() const {return const_iterator(_slots.data(), _slots.data() + _slots.size());}
+	const_iterator end() const {return const_iterator(_slots.data() + _slots.size(), _slots.data() + _slots.size());}
+
+	inline size_t size() const {return _size;}
+	inline bool	  empty() const {return _size == 0;}
+	inline size_t capacity() const {return _slots.size();}
+	inline float  load_factor() const {return _slots.empty() ? 0.0f : (float)_size / _slots.size();}
+	inline size_t memoryUsage() const {return _slots.size() * sizeof(Slot);}
+
+	/*
+	 * bytes of the table once it has room for n elements (what reserve(n) grows it to)
+	 */
+	inline size_t memoryFor(size_t n) const
+	{
+		size_t bytes = memoryFor(n, _maxLoadFactor);
+		return bytes > memoryUsage() ? bytes : memoryUsage();
+	}
+
+	static size_t memoryFor(size_t n, float maxLoadFactor)
+	{
+		if(!(maxLoadFactor > 0.0f && maxLoadFactor < 1.0f))
+			maxLoadFactor = 0.7f;
+		return roundUpPow2((size_t)(n / maxLoadFactor) + 1) * sizeof(Slot);
+	}
+
+	/*
+	 * open addressing can not go above 1 - anything outside of (0,1) falls back to the default
+	 */
+	void max_load_factor(float f)
+	{
+		_maxLoadFactor = (f > 0.0f && f < 1.0f) ? f : 0.7f;
+		_growAt = (size_t)(_slots.size() * _maxLoadFactor);
+		if(_size >= _growAt && !_slots.empty())
+			rehash(_slots.size() * 2);
+	}
+
+	/*
+	 * make room for n elements without growing - reserve(0) on an empty table gives back the memory
+	 */
+	void reserve(size_t n)
+	{
+		if(n == 0 && _size == 0)
+		{
+			std::vector<Slot>().swap(_slots);
+			_mask = 0;
+			_shift = 0;
+			_growAt = 0;
+			return;
+		}
+		size_t needed = roundUpPow2((size_t)(n / _maxLoadFactor) + 1);
+		if(needed > _slots.size())
+			rehash(needed);
+	}
+
+	void clear()
+	{
+		if(_size == 0)
+			return;
+		for(Slot& s : _slots)
+			s = Slot();
+		_size = 0;
+	}
+
+	Value& operator[](const Key& key)
+	{
+		if(_size >= _growAt)
+			rehash(_slots.empty() ? 16 : _slots.size() * 2);
+		size_t i = slotOf(key);
+		while(true)
+		{
+			Slot& s = _slots[i];
+			if(!s.used)
+			{
+				s.used = true;
+				s.kv.first = key;
+				s.kv.second = Value();
+				++_size;
+				return s.kv.second;
+			}
+			if(s.kv.first == key)
+				return s.kv.second;
+			i = (i + 1) & _mask;
+		}
+	}
+
+	const_iterator find(const Key& key) const
+	{
+		if(_size == 0)
+			return end();
+		size_t i = slotOf(key);
+		while(_slots[i].used)
+		{
+			if(_slots[i].kv.first == key)
+				return const_iterator(&_slots[i], _slots.data() + _slots.size());
+			i = (i + 1) & _mask;
+		}
+		return end();
+	}
+
+	size_t count(const Key& key) const {return find(key) == end() ? 0 : 1;}
+
+private:
+	inline size_t slotOf(const Key& key) const
+	{
+		return (((uint64_t)_hash(key) ^ _seed) * 0x9e3779b97f4a7c15ULL) >> _shift;
+	}
+
+	static uint64_t nextSeed()
+	{
+		static std::atomic<uint64_t> seeds(0);
+		return seeds.fetch_add(0x2545f4914f6cdd1dULL);
+	}
+
+	static size_t roundUpPow2(size_t n)
+	{
+		size_t p = 16;
+		while(p < n)
+			p <<= 1;
+		return p;
+	}
+
+	void rehash(size_t newCapacity)
+	{
+		std::vector<Slot> old;
+		old.swap(_slots);
+		_slots.resize(newCapacity);
+		_mask = newCapacity - 1;
+		_shift = 64;
+		for(size_t c = newCapacity; c > 1; c >>= 1)
+			--_shift;
+		_growAt = (size_t)(newCapacity * _maxLoadFactor);
+		for(Slot& s : old)
+		{
+			if(!s.used)
+				continue;
+			size_t i = slotOf(s.kv.first);
+			while(_slots[i].used)
+				i = (i + 1) & _mask;
+			_slots[i].used = true;
+			_slots[i].kv = s.kv;
+		}
+	}
+
+private:
+	std::vector<Slot> _slots;
+	size_t			  _size;
+	size_t			  _mask;
+	unsigned		  _shift;
+	size_t			  _growAt;
+	float			  _maxLoadFactor;
+	uint64_t		  _seed;
+	Hash			  _hash;
+};
+
+}
+
+#endif
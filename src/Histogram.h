@@ -0,0 +1,83 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <vector>
+#include <map>
+#include <string>
+#include <cstdio>
+#include <stdexcept>
+
+namespace kmers
+{
+
+/**
+ * The abundance histogram (k-mer spectrum) of a count: how many distinct kmers were seen 1, 2, 3, ... times. The low
+ * counts (where nearly all the kmers are) go into a flat array, the rare high ones into a map - so a histogram per
+ * partition is cheap and they are summed up once everything is counted.
+ */
+class Histogram
+{
+public:
+	Histogram() : _dense(_denseCounts, 0) {}
+
+	inline void add(size_t count, unsigned long long distinct = 1)
+	{
+		if(count < _denseCounts)
+			_dense[count] += distinct;
+		else
+			_sparse[count] += distinct;
+	}
+
+	void merge(const Histogram& other)
+	{
+		for(size_t i=0;i<_denseCounts;i++)
+			_dense[i] += other._dense[i];
+		for(const auto& p : other._sparse)
+			_sparse[p.first] += p.second;
+	}
+
+	unsigned long long distinct() const
+	{
+		unsigned long long total = 0;
+		forEach([&total](size_t, unsigned long long distinct) { total += distinct; });
+		return total;
+	}
+
+	/*
+	 * calls fn(count, distinct) for the counts seen, ascending
+	 */
+	template<class Fn>
+	void forEach(Fn fn) const
+	{
+		for(size_t i=0;i<_denseCounts;i++)
+		{
+			if(_dense[i])
+				fn(i, _dense[i]);
+		}
+		for(const auto& p : _sparse)
+			fn(p.first, p.second);
+	}
+
+	/*
+	 * one "count distinct" line per count seen, ascending (the format the genome size estimators read)
+	 */
+	void write(const std::string& path) const
+	{
+		FILE* out = fopen(path.c_str(), "w");
+		if(!out)
+			throw std::runtime_error("Could not write the histogram to " + path);
+		forEach([out](size_t count, unsigned long long distinct) { fprintf(out, "%lu %llu\n", (unsigned long)count, distinct); });
+		if(fclose(out) != 0)
+			throw std::runtime_error("Could not write the histogram to " + path);
+	}
+
+private:
+	static const size_t _denseCounts = 1 << 12;
+
+	std::vector<unsigned long long> _dense;
+	std::map<size_t, unsigned long long> _sparse;
+};
+
+}
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef KMERBATCH_H_
+#define KMERBATCH_H_
+
+#include <KmerEngine.h>
+#include <WorkerPool.h>
+#include <MemoryBudget.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace kmers
+{
+
+using std::string;
+using std::vector;
+using std::pair;
+
+/*
+ * an input of a batch - name: what its outputs are told apart by (the file name of the path if empty)
+ */
+struct BatchInput
+{
+	string path;
+	string name;
+};
+
+/*
+ * what an input of a batch came to: the results and the total kmer count of every k (in the order of the ks of the
+ * batch), what its engine reported on the way and the error it failed with (empty if it did not)
+ */
+struct BatchResult
+{
+	BatchInput input;
+	size_t	   index;	// in the inputs of the batch
+	vector<vector<pair<string, size_t>>> results;
+	vector<unsigned long long> totalKmerCounts;
+	string	   log;
+	string	   error;
+};
+
+/**
+ * Counts many inputs on one WorkerPool instead of a process (threads, tables and spills in the working directory) per
+ * input. filesAtOnce inputs are counted at a time, each one by a KmerEngine of its own fed by a thread of the batch
+ * into the shared workers: the small files overlap, the blocks of a big one spread over all the workers as they always
+ * do. The biggest inputs are started first so a big one does not come last and run alone.
+ *
+ * Every input gets its own results and its own names: the spills go to <spillPrefix>_<index>_..., the database, the
+ * histogram and the metrics to <path>.<name>. The memory budget is split evenly among the inputs counted at a time and
+ * the periodic metrics snapshots are off (they could not be told apart). An input that fails - on the reader or on the
+ * workers - fails only its own BatchResult, the others go on.
+ */
+class KmerBatch
+{
+public:
+	KmerBatch(const vector<BatchInput>& inputs, const vector<size_t>& ks, int n, int threadCount,
+			  const EngineConfig& config = EngineConfig(), size_t filesAtOnce = 0) : _inputs(inputs),
+																					 _ks(ks),
+																					 _n(n),
+																					 _threadCount(std::max(threadCount, 1)),
+																					 _config(config)
+	{
+		if(_inputs.empty())
+			throw std::runtime_error("No input to count!");
+		std::set<string> names;
+		for(BatchInput& input : _inputs)
+		{
+			if(input.name.empty())
+				input.name = nameOf(input.path);
+			if(!names.insert(input.name).second)
+				throw std::runtime_error("Two inputs named " + input.name + "!");
+		}
+		_filesAtOnce = std::min(filesAtOnce ? filesAtOnce : (size_t)_defaultFilesAtOnce, _inputs.size());
+	}
+
+	const vector<BatchInput>& inputs() const {return _inputs;}
+
+	/*
+	 * counts every input - done(const BatchResult&) is called as each one is finished (one call at a time)
+	 */
+	template<class Fn>
+	void run(Fn done)
+	{
+		WorkerPool pool(_threadCount, _threadCount * _queuedBlocksPerWorker);
+		vector<size_t> order = biggestFirst();
+		std::atomic<size_t> next(0);
+		std::mutex doneMutex;
+		vector<std::thread> threads;
+		for(size_t t=0;t<_filesAtOnce;t++)
+		{
+			threads.push_back(std::thread([this, &pool, &order, &next, &doneMutex, &done]()
+										  {
+											for(size_t i = next++; i < order.size(); i = next++)
+											{
+												BatchResult result = count(order[i], pool);
+												std::lock_guard<std::mutex> lock(doneMutex);
+												done(result);
+											}
+										  }));
+		}
+		for(std::thread& t : threads)
+			t.join();
+	}
+
+	/*
+	 * one input per line: its path and optionally its name after white space - empty lines and the ones starting
+	 * with # are skipped
+	 */
+	static vector<BatchInput> readManifest(const string& path)
+	{
+		std::ifstream in(path.c_str());
+		if(!in)
+			throw std::runtime_error("Could not read the manifest " + path);
+		vector<BatchInput> inputs;
+		string line;
+		while(std::getline(in, line))
+		{
+			std::istringstream fields(line);
+			BatchInput input;
+			if(!(fields >> input.path) || input.path[0] == '#')
+				continue;
+			fields >> input.name;
+			inputs.push_back(input);
+		}
+		return inputs;
+	}
+
+private:
+	BatchResult count(size_t index, WorkerPool& pool)
+	{
+		BatchResult result;
+		result.input = _inputs[index];
+		result.index = index;
+		std::ostringstream log;
+
+		EngineConfig config = _config;
+		config.workers = &pool;
+		config.out = &log;
+		config.maxMemory = (_config.maxMemory ? _config.maxMemory : MemoryBudget::defaultLimit()) / _filesAtOnce;
+		config.spillPrefix = _config.spillPrefix + "_" + std::to_string(index);
+		config.databasePath = outputPath(_config.databasePath, result.input.name);
+		config.histogramPath = outputPath(_config.histogramPath, result.input.name);
+		config.metricsPath = outputPath(_config.metricsPath, result.input.name);
+		config.metricsInterval = 0;
+		try
+		{
+			if(!std::ifstream(result.input.path.c_str()))
+				throw std::runtime_error("Could not open " + result.input.path);
+			KmerEngine engine(result.input.path, _ks, _n, _threadCount, config);
+			engine.start();
+			for(size_t k : _ks)
+			{
+				result.results.push_back(engine.getResults(k));
+				result.totalKmerCounts.push_back(engine.totalKmerCount(k));
+			}
+			engine.writeMetrics();
+		}
+		catch(const std::exception& e)
+		{
+			result.error = e.what();
+		}
+		result.log = log.str();
+		return result;
+	}
+
+	vector<size_t> biggestFirst() const
+	{
+		vector<pair<size_t, size_t>> sizes;
+		for(size_t i=0;i<_inputs.size();i++)
+		{
+			struct stat st;
+			sizes.push_back(std::make_pair(stat(_inputs[i].path.c_str(), &st) == 0 ? (size_t)st.st_size : 0, i));
+		}
+		std::stable_sort(sizes.begin(), sizes.end(), [](const pair<size_t, size_t>& a, const pair<size_t, size_t>& b)
+						 {
+							return a.first > b.first;
+						 });
+		vector<size_t> order;
+		for(const auto& s : sizes)
+			order.push_back(s.second);
+		return order;
+	}
+
+	static string nameOf(const string& path)
+	{
+		size_t slash = path.find_last_of('/');
+		return slash == string::npos ? path : path.substr(slash + 1);
+	}
+
+	static string outputPath(const string& path, const string& name)
+	{
+		return path.empty() ? path : path + "." + name;
+	}
+
+private:
+	static const size_t _defaultFilesAtOnce = 4;
+	static const size_t _queuedBlocksPerWorker = 4;
+
+	vector<BatchInput> _inputs;
+	vector<size_t>	   _ks;
+	int				   _n;
+	int				   _threadCount;
+	EngineConfig	   _config;
+	size_t			   _filesAtOnce;
+};
+
+}
+
+#endif
@@ -11,6 +11,11 @@
 #include <StopWatch.h>
 #include <Mer.h>
 #include <MerMap.h>
+#include <FlatHashMap.h>
+#include <TopN.h>
+#include <BaseKernel.h>
+#include <BloomFilter.h>
+#include <ConcurrentMerTable.h>
 
 #include <cstring>
 #include <string>
@@ -60,11 +65,15 @@ private:
 };
 
 
+/*
+ * initialSize: number of elements to make room for up front
+ * maxLoadFactor: occupancy of the open addressed tables at which they grow, has to be in (0,1)
+ */
 struct HashTableConfig
 {
-	HashTableConfig(size_t initSize_, size_t maxLoadFactor_) :  initialSize(initSize_), maxLoadFactor(maxLoadFactor_) {}
+	HashTableConfig(size_t initSize_, float maxLoadFactor_) :  initialSize(initSize_), maxLoadFactor(maxLoadFactor_) {}
 	size_t initialSize;
-	size_t maxLoadFactor;
+	float  maxLoadFactor;
 };
 
 
@@ -151,18 +160,24 @@ private:
 };
 
 
+/*
+ * owner: the chunk was handed over with the (new[]-ed) memory under it and deallocate frees it - chunks pointing
+ * into memory that lives elsewhere (e.g. a file mapping) are not owners and deallocate just forgets the range
+ */
 class Chunk
 {
 public:
-	Chunk() : _begin(nullptr), _end(nullptr) {}
-	Chunk(const char* begin, const char* end) : _begin(begin), _end(end) {}
+	Chunk() : _begin(nullptr), _end(nullptr), _owner(false) {}
+	Chunk(const char* begin, const char* end, bool owner = true) : _begin(begin), _end(end), _owner(owner) {}
 	const char* begin() const {return _begin;}
 	const char* end() const {return _end;}
 	size_t	    size() const {return _end-_begin;}
+	bool		owner() const {return _owner;}
 
 	void deallocate()
 	{
-		free(const_cast<char*>(_begin));
+		if(_owner)
+			delete[] _begin;
 		_begin = nullptr;
 		_end = nullptr;
 	}
@@ -170,235 +185,324 @@ public:
 private:
 	const char* _begin;
 	const char* _end;	// not included (C++ iterator style range)
+	bool		_owner;
 };
 
 
 /*
-	 * k: kmer length
-	 * creates contiguous memory from the crossings between the two chunks which depends on the kmer length (k)
-	 * return a pointer to the allocated memory - the client needs to free it!
-	 * assumes that k is smaller than the chunk length!
-	 */
-Chunk createCrossMemorySection(const Chunk& chunk1, const Chunk& chunk2, int k)
+ * Translates sequence into base codes a piece at a time by the vector kernel: the groups without a special byte are
+ * taken straight from the kernel, only the rest looks at the chars - line breaks are not part of the sequence and are
+ * left out, anything else not a base throws. Every piece goes to sink(const uint8_t* codes, size_t len) as soon as it is
+ * translated, small enough to still be in L1 for every counter fed from the same scan.
+ */
+class BaseScanner
 {
-	int num1 = k-1;
-	int num2 = k-1;
-	if(num2 > chunk2.size())
-		num2 = chunk2.size();
+public:
+	/*
+	 * returns the number of bases in [begin, end)
+	 */
+	template<class Sink>
+	size_t scan(const char* begin, const char* end, Sink sink)
+	{
+		size_t bases = 0;
+		for(const char* piece = begin; piece < end; piece += _piece)
+		{
+			size_t len = end - piece < (ptrdiff_t)_piece ? end - piece : _piece;
+			kernel::translateBases(piece, len, _codes, _special);
+			// the codes are packed in place: filled never gets ahead of the code being looked at
+			size_t filled = 0;
+			for(size_t g = 0; g * kernel::groupSize < len; g++)
+			{
+				size_t groupBegin = g * kernel::groupSize;
+				size_t groupEnd = std::min(len, groupBegin + kernel::groupSize);
+				uint64_t special = _special[g];
+				if(!special)
+				{
+					if(filled != groupBegin)
+						memmove(_codes + filled, _codes + groupBegin, groupEnd - groupBegin);
+					filled += groupEnd - groupBegin;
+					continue;
+				}
+				for(size_t i=groupBegin;i<groupEnd;i++)
+				{
+					uint8_t code = _codes[i];
+					if((special >> (i - groupBegin)) & 1)
+					{
+						char c = piece[i];
+						if(c == '\n' || c == '\r')
+							continue;
+						code = getIndex(c);
+					}
+					_codes[filled++] = code;
+				}
+			}
+			sink(static_cast<const uint8_t*>(_codes), filled);
+			bases += filled;
+		}
+		return bases;
+	}
 
-	char* mem = new char[ num1 + num2];		// the crossing section has k-1 elements from both chunks
-	const char* start = chunk1.end() - k + 1;
-	memcpy(mem, start, num1);		// copy the remainder from the first chunk
-	memcpy(mem+num1, chunk2.begin(), num2); // copy from the second chunk
+	/*
+	 * the codes of at most maxBases bases of [begin, end) - the start of a record going on in the next block. They are
+	 * valid until the next call
+	 */
+	const uint8_t* prefix(const char* begin, const char* end, size_t maxBases, size_t& len)
+	{
+		len = 0;
+		for(const char* curr = begin; curr != end && len < maxBases && len < _piece; curr++)
+		{
+			if(*curr == '\n' || *curr == '\r')
+				continue;
+			_codes[len++] = getIndex(*curr);
+		}
+		return _codes;
+	}
 
-	return Chunk(mem, mem+num1+num2);
+private:
+	static const size_t _piece = 1 << 12;
 
-}
+	uint8_t	 _codes[_piece];
+	uint64_t _special[_piece / kernel::groupSize];
+};
 
 /*
- * brute force extraction of the top n size elements
+ * A counter fed by a scan it does not run itself - several k counted from the same BaseScanner: every record is
+ * beginRecord, its codes piece by piece and endRecord with the codes of its continuation in the next block (none if the
+ * record ends in the block)
  */
-template<class T>
-void extract(vector<pair<T, size_t>>& res, const vector<pair<T, size_t>>& from, int n)
+class CodeSink
 {
+public:
+	virtual ~CodeSink() {}
+
+	virtual void beginRecord() = 0;
+	virtual void countCodes(const uint8_t* codes, size_t len) = 0;
+	virtual void endRecord(const uint8_t* next, size_t len) = 0;
+};
 
-	int count = 0;
-	size_t limitSize = std::numeric_limits<size_t>::max();
-	while(count < n)
-	{
-		size_t biggest = 0;
-		for(const auto& p : from)
-		{
-			if(p.second > biggest && p.second < limitSize)
-				biggest = p.second;
-		}
-		count++;
-		limitSize = biggest;
-		// second pass -> populate the res array with the biggest sizes
-		for(const auto& p : from)
-		{
-			if(p.second == biggest)
-			{
-				res.push_back(p);
-			}
-		}
-	}
 
+/*
+ * appends the elements having one of the top n distinct counts (ties included) to res, biggest count first
+ */
+template<class T>
+void extract(vector<pair<T, size_t>>& res, const vector<pair<T, size_t>>& from, int n)
+{
+	TopNSelector<pair<T, size_t>, PairCount> selector(n < 0 ? 0 : n);
+	selector.add(from.begin(), from.end());
+	vector<pair<T, size_t>> top = selector.result();
+	std::copy(top.begin(), top.end(), back_inserter(res));
 }
 
 
 /*
- * this one can compare only contiguous memory
+ * Counts the kmers of any number of blocks into the same table - it is meant to be kept by a worker across blocks
+ * and drained (extractProcessingResult + clear) once the table is full. Mer: the key width, has to fit k
  */
-class KmerCounter
+template<class Mer>
+class KmerCounter : public CodeSink
 {
-	using HashMap = std::unordered_map<mer_encoded, size_t, mer_encoded_hash>;
+	using Roller = RollingEncoder<Mer>;
 public:
-	KmerCounter(Chunk chunk, size_t k, size_t n, const HashTableConfig& config) :
-																			_chunk1(chunk),
-																			_hasTwoChunks(false),
-																			_totalLen(chunk.end()-chunk.begin()),
-																			_k(k),
-																			_n(n),
-																			_hashConfig(config)
-	{
-		init();
-	}
+	using HashMap = FlatHashMap<Mer, size_t, mer_encoded_hash<Mer>>;
+	using Prefilter = BloomFilter<Mer, mer_encoded_hash<Mer>>;
+	using SharedTable = ConcurrentMerTable<Mer, mer_encoded_hash<Mer>>;
 
-	KmerCounter(Chunk chunk1, Chunk chunk2, size_t k, size_t n, const HashTableConfig& config) : _chunk1(chunk1),
-																								 _chunk2(chunk2),
-																								 _hasTwoChunks(true),
-																								 _k(k),
-																								 _n(n),
-																								 _hashConfig(config)
+	/*
+	 * canonical: a kmer and its reverse complement are counted as one (the smaller encoding of the two)
+	 */
+	KmerCounter(size_t k, size_t n, const HashTableConfig& config, bool canonical = false) : _expectedCount(0),
+																							  _filtered(0),
+																							  _k(k),
+																							  _n(n),
+																							  _canonical(canonical),
+																							  _roller(k, canonical),
+																							  _recordBases(0),
+																							  _prefilter(nullptr),
+																							  _only(nullptr),
+																							  _shared(nullptr),
+																							  _hashConfig(config)
 	{
-		int secondpartSize = k-1;
-		if(secondpartSize > chunk2.size())
-			secondpartSize = chunk2.size();
-		_totalLen = chunk1.size() + secondpartSize;
 		init();
 	}
 
+	/*
+	 * prefilter: a kmer only gets into the table once the (shared) filter has seen it before - the first sighting of
+	 * every kmer is left out. only: just the kmers in the set are counted. The kmers left out are counted in filtered()
+	 */
+	void setPrefilter(Prefilter* prefilter) {_prefilter = prefilter;}
+	void setOnly(const HashMap* only) {_only = only;}
+	/*
+	 * shared: the kmers go straight into the shared table instead of the own one (set while the writer is alive)
+	 */
+	void setShared(typename SharedTable::Writer* shared) {_shared = shared;}
+
 	virtual ~KmerCounter()
 	{
-		_chunk1.deallocate();
-		_crossing.deallocate();
 	}
 
-	virtual void process()
+	/*
+	 * counts the kmers starting in chunk - next is the chunk following it in the input (empty if chunk is the last one)
+	 */
+	void count(const Chunk& chunk, const Chunk& next)
 	{
-		count();
+		countRecord(chunk, next);
 	}
 
-	void extractProcessingResult(MerMap& database_)
+	/*
+	 * counts the kmers starting in the segments of a parsed block - every segment is a separate record, only the last
+	 * one goes on in next (empty if its record ends in the block)
+	 */
+	void count(const vector<Chunk>& segments, const Chunk& next)
 	{
-		unsigned long long totalCount = 0;
-		int hashmapCount=0;
-		// might be very expensive the string construction below plus memory problems on high k size (5^k) very high k length and
-		// random pattern makes the substring count easily (filesize-kmerLen) - and at hsi point we just have a local result
-		_sw.start();
-		for(HashMap::const_iterator it=_stringMap.begin(); it!=_stringMap.end(); it++)
-		{
-			hashmapCount++;
-			totalCount+=it->second;
-			const auto& pair = *it;
-			const mer_encoded& mem = pair.first;
-			size_t count = pair.second;
-			database_[mem]+=count;
-		}
-
-		//cout << "Took: " << _sw.stop() << endl;
-		//printf("total count: %d and totalLen: %d and %d\n", totalCount, _totalLen, (int)_totalLen-(int)_k+1);
-		assert(totalCount == std::max((int)_totalLen-(int)_k+1,0));
-		//cout << "hashmap count: " << hashmapCount << "\n";
+		for(size_t i=0;i<segments.size();i++)
+			countRecord(segments[i], i + 1 == segments.size() ? next : Chunk());
+	}
 
+	/*
+	 * a record of a block scanned for several counters (see CodeSink) - the continuation is used up to k-1 bases
+	 */
+	void beginRecord()
+	{
+		_roller.reset();
+		_recordBases = 0;
 	}
 
-protected:
-	void init()
+	void countCodes(const uint8_t* codes, size_t len)
 	{
-		_stringMap.reserve(_hashConfig.initialSize);
-		_stringMap.max_load_factor(_hashConfig.maxLoadFactor);
+		_recordBases += rollCodes(_roller, codes, len);
 	}
 
-	void count()
+	void endRecord(const uint8_t* next, size_t len)
 	{
-		if(_hasTwoChunks)
-		{
-			countInChunk(_chunk1);
-			// deal with the crossing into the second chunk -- this is tricky (and annoying) - since k is assumed to be much smaller than the chunk size: need to create contiguous memory from the two (malloc? then free later)
-			// we own! chunk! will have to free later (when is later? once we created the strings from under these raw char pointers -> then we can get rid of the memory)
-			// the last chunk (_chunk2) might not even have _k elems!
-			_crossing = createCrossMemorySection(_chunk1, _chunk2, _k);
-			countInChunk(_crossing);
-		}
-		else
-		{
-			countInChunk(_chunk1);
-		}
+		_recordBases += rollCodes(_roller, next, len < _k - 1 ? len : _k - 1);
+		_expectedCount += _recordBases >= _k ? _recordBases - _k + 1 : 0;
 	}
 
+	inline size_t size() const {return _stringMap.size();}
+	// kmers counted since the last clear (in the table or not)
+	inline unsigned long long counted() const {return _expectedCount;}
+	// kmers counted since the last clear that were left out of the table
+	inline unsigned long long filtered() const {return _filtered;}
+	inline bool	  empty() const {return _stringMap.empty();}
 
-	void countInChunk(const Chunk& chunk)
+	/*
+	 * scatters the table into one batch per hash partition (batches.size() partitions)
+	 */
+	void extractProcessingResult(vector<vector<mer_count<Mer>>>& batches)
 	{
-		for(const char* curr = chunk.begin(); curr+_k<=chunk.end(); curr++)
+		unsigned long long totalCount = 0;
+		size_t numOfPartitions = batches.size();
+		for(auto& batch : batches)
+			batch.reserve(batch.size() + _stringMap.size() / numOfPartitions + 1);
+		for(typename HashMap::const_iterator it=_stringMap.begin(); it!=_stringMap.end(); it++)
 		{
-			mer_encoded mer = encode(curr, _k);
-			++_stringMap[mer];
+			totalCount+=it->second;
+			batches[partitionOf(it->first, numOfPartitions)].push_back(mer_count<Mer>(it->first, it->second));
 		}
+		assert(totalCount + _filtered == _expectedCount);
 	}
 
-
-protected:
-	Chunk	_chunk1;
-	Chunk	_chunk2;
-	Chunk   _crossing;
-	bool	_hasTwoChunks;
-	size_t	_totalLen;
-	size_t _k;
-	size_t _n;
-	HashMap _stringMap;
-	HashTableConfig _hashConfig;
-	StopWatch<chrono::milliseconds> _sw;
-};
-
-
-
-class KmerCounterThreaded : public KmerCounter
-{
-public:
-	KmerCounterThreaded(Chunk chunk1, size_t k, size_t n, const HashTableConfig& config, bool startOnConstruction) :
-																					KmerCounter(chunk1, k, n, config),
-																					_startOnConstruction(startOnConstruction),
-																					_finished(false)
-
+	/*
+	 * calls fn(mer, count) for every kmer of the table
+	 */
+	template<class Fn>
+	void forEach(Fn fn) const
 	{
-		if(_startOnConstruction)
-			kickoff();
+		for(const auto& p : _stringMap)
+			fn(p.first, p.second);
 	}
 
-	KmerCounterThreaded(Chunk chunk1, Chunk chunk2, size_t k, size_t n, const HashTableConfig& config, bool startOnConstruction) :
-																						KmerCounter(chunk1, chunk2, k, n, config),
-																						_startOnConstruction(startOnConstruction),
-																						_finished(false)
-
+	/*
+	 * empties the table but keeps its memory for the next blocks
+	 */
+	void clear()
 	{
-		if(_startOnConstruction)
-			kickoff();
+		_stringMap.clear();
+		_expectedCount = 0;
+		_filtered = 0;
 	}
 
-	~KmerCounterThreaded()
+protected:
+	void init()
 	{
+		_stringMap.max_load_factor(_hashConfig.maxLoadFactor);
+		_stringMap.reserve(_hashConfig.initialSize);
 	}
 
-	thread&		threadHandle() {return _processingThread;}
+	void countRecord(const Chunk& chunk, const Chunk& next)
+	{
+		Roller roller(_k, _canonical);
+		size_t bases = countInChunk(roller, chunk.begin(), chunk.end());
+		// the kmers crossing into the next chunk: keep rolling the same window over the first k-1 bases of next
+		// (the last chunk might not even have _k bases!) - no contiguous copy of the crossing is needed
+		bases += countPrefix(roller, next.begin(), next.end(), _k-1);
+		_expectedCount += bases >= _k ? bases - _k + 1 : 0;
+	}
 
-	void start()
+	inline void add(const Mer& mer)
 	{
-		if(!_startOnConstruction)
+		if((_prefilter && !_prefilter->testAndSet(mer)) || (_only && !_only->count(mer)))
 		{
-			kickoff();
+			++_filtered;
+			return;
 		}
+		if(_shared)
+			_shared->add(mer);
 		else
-			throw std::runtime_error("Already started in constructor!");
+			++_stringMap[mer];
 	}
 
-protected:
-	void kickoff()
+	/*
+	 * rolls over [begin, end) as the BaseScanner translates it
+	 */
+	size_t countInChunk(Roller& roller, const char* begin, const char* end)
 	{
-		_processingThread = thread(&KmerCounterThreaded::process, this);
+		return _scanner.scan(begin, end, [this, &roller](const uint8_t* codes, size_t len) { rollCodes(roller, codes, len); });
 	}
 
-	virtual void process()
+	size_t rollCodes(Roller& roller, const uint8_t* codes, size_t len)
 	{
-		KmerCounter::process();
-		_finished.store(true);
+		for(size_t i=0;i<len;i++)
+		{
+			if(roller.rollIndex(codes[i]))
+				add(roller.mer());
+		}
+		return len;
+	}
+
+	/*
+	 * rolls over at most maxBases bases of [begin, end)
+	 */
+	size_t countPrefix(Roller& roller, const char* begin, const char* end, size_t maxBases)
+	{
+		size_t bases = 0;
+		for(const char* curr = begin; curr!=end && bases<maxBases; curr++)
+		{
+			if(*curr == '\n' || *curr == '\r')
+				continue;
+			++bases;
+			if(roller.roll(*curr))
+				add(roller.mer());
+		}
+		return bases;
 	}
 
+
 protected:
-	thread _processingThread;
-	bool _startOnConstruction;
-	atomic<bool> _finished;
+	unsigned long long _expectedCount;
+	unsigned long long _filtered;
+	size_t _k;
+	size_t _n;
+	bool   _canonical;
+	Roller _roller;				// the record fed in by a CodeSink scan
+	size_t _recordBases;
+	Prefilter*	   _prefilter;
+	const HashMap* _only;
+	typename SharedTable::Writer* _shared;
+	HashMap _stringMap;
+	HashTableConfig _hashConfig;
+	StopWatch<chrono::milliseconds> _sw;
+	BaseScanner _scanner;
 };
 
 
@@ -0,0 +1,637 @@
+#ifndef KMERDATABASE_H_
+#define KMERDATABASE_H_
+
+#include <Mer.h>
+#include <MerMap.h>
+#include <FileIO.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace kmers
+{
+
+using std::string;
+using std::vector;
+using std::thread;
+using std::unique_ptr;
+
+/**
+ * On disk kmer database - every distinct kmer with its count, sorted, with a prefix index so a lookup is one index
+ * read and a search among the handful of records under the prefix. Meant to be mapped and queried in place.
+ *
+ *   header  (64 bytes, see DatabaseHeader)
+ *   index   (2^indexBits + 1) x uint64: number of the first record whose key has (at least) the prefix
+ *   records numOfKmers x (keyBytes + countBytes), packed
+ *
+ * The key of a kmer is its encoding as one 3k bit number: base i (a=0, c=1, g=2, t=3, n=4) at bits 3i - the same order
+ * as Mer's operator<, so the sorted runs of the partitions come out in key order. It is stored in keyBytes little
+ * endian bytes, the count in countBytes (as few as the biggest count needs), the prefix of a key is its top indexBits
+ * bits. Everything is little endian.
+ */
+struct DatabaseHeader
+{
+	static const uint32_t currentVersion = 1;
+	static const uint16_t encoding3Bit = 1;		// the encoding above
+	static const uint16_t canonicalFlag = 1;
+	static const uint32_t maxIndexBits = 24;	// the biggest index the writer builds
+
+	char	 magic[8];
+	uint32_t version;
+	uint32_t k;
+	uint16_t encoding;
+	uint16_t flags;
+	uint16_t keyBytes;
+	uint16_t countBytes;
+	uint32_t indexBits;
+	uint32_t reserved;
+	uint64_t numOfKmers;
+	uint64_t totalCount;
+	uint64_t indexOffset;
+	uint64_t recordsOffset;
+
+	static const char* magicString() {return "KMERDB\r\n";}
+};
+
+static_assert(sizeof(DatabaseHeader) == 64, "The database header has to stay 64 bytes!");
+
+namespace db
+{
+
+inline size_t keyBytesFor(size_t k) {return (3 * k + 7) / 8;}
+
+inline size_t countBytesFor(uint64_t maxCount)
+{
+	size_t bytes = 1;
+	while(bytes < 8 && (maxCount >> (8 * bytes)))
+		++bytes;
+	return bytes;
+}
+
+/*
+ * the top 64 bits of the key of bits bits (the lower ones zero for shorter keys)
+ */
+inline uint64_t topBits(const uint8_t* key, size_t keyBytes, size_t bits)
+{
+	uint64_t top = 0;
+	long shift = (long)bits - 64;
+	for(size_t b=0;b<keyBytes;b++)
+	{
+		long pos = (long)(8 * b) - shift;
+		if(pos >= 64 || pos <= -8)
+			continue;
+		top |= pos >= 0 ? (uint64_t)key[b] << pos : (uint64_t)key[b] >> -pos;
+	}
+	return top;
+}
+
+inline uint64_t prefixOf(const uint8_t* key, size_t keyBytes, size_t bits, size_t indexBits)
+{
+	return indexBits ? topBits(key, keyBytes, bits) >> (64 - indexBits) : 0;
+}
+
+/*
+ * key order: most significant byte first
+ */
+inline int compareKeys(const uint8_t* lhs, const uint8_t* rhs, size_t keyBytes)
+{
+	for(size_t b=keyBytes;b-->0;)
+	{
+		if(lhs[b] != rhs[b])
+			return lhs[b] < rhs[b] ? -1 : 1;
+	}
+	return 0;
+}
+
+inline void putCode(uint8_t* key, size_t i, uint64_t code)
+{
+	size_t bit = 3 * i;
+	key[bit / 8] |= (uint8_t)(code << (bit % 8));
+	if(bit % 8 > 5)
+		key[bit / 8 + 1] |= (uint8_t)(code >> (8 - bit % 8));
+}
+
+inline uint64_t getCode(const uint8_t* key, size_t i)
+{
+	size_t bit = 3 * i;
+	uint64_t v = key[bit / 8] >> (bit % 8);
+	if(bit % 8 > 5)
+		v |= (uint64_t)key[bit / 8 + 1] << (8 - bit % 8);
+	return v & 0x7;
+}
+
+template<class Mer>
+inline void keyOf(const Mer& mer, size_t k, uint8_t* key)
+{
+	memset(key, 0, keyBytesFor(k));
+	for(size_t i=0;i<k;i++)
+		putCode(key, i, (mer.w[i / Mer::basesPerWord] >> ((i % Mer::basesPerWord) * 3)) & 0x7);
+}
+
+inline void keyOf(const string& kmer, uint8_t* key)
+{
+	memset(key, 0, keyBytesFor(kmer.size()));
+	for(size_t i=0;i<kmer.size();i++)
+		putCode(key, i, getIndex(kmer[i]));
+}
+
+/*
+ * the key of the kmer and of its reverse complement in one go
+ */
+inline void keysOf(const string& kmer, uint8_t* key, uint8_t* rc)
+{
+	size_t k = kmer.size();
+	memset(key, 0, keyBytesFor(k));
+	memset(rc, 0, keyBytesFor(k));
+	for(size_t i=0;i<k;i++)
+	{
+		uint64_t code = getIndex(kmer[i]);
+		putCode(key, i, code);
+		putCode(rc, k - 1 - i, complementIndex(code));
+	}
+}
+
+/*
+ * whether the record starts with the key - with wide both are readable for 32 bytes (the key buffers are that long,
+ * the records are unless they are at the very end of the file) and 16 bytes are compared at a time
+ */
+inline bool keyEquals(const uint8_t* record, const uint8_t* key, size_t keyBytes, bool wide)
+{
+#ifdef KMERS_X86_KERNELS
+	if(wide)
+	{
+		uint32_t eq = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(record)),
+																  _mm_loadu_si128(reinterpret_cast<const __m128i*>(key))));
+		if(keyBytes > 16)
+			eq |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(record + 16)),
+															  _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 16)))) << 16;
+		uint32_t needed = keyBytes >= 32 ? 0xffffffffu : ((1u << keyBytes) - 1);
+		return (eq & needed) == needed;
+	}
+#endif
+	return memcmp(record, key, keyBytes) == 0;
+}
+
+inline string decodeKey(const uint8_t* key, size_t k)
+{
+	string s(k, 0);
+	for(size_t i=0;i<k;i++)
+		s[i] = fromIndex((char)getCode(key, i));
+	return s;
+}
+
+inline void putCount(uint8_t* to, uint64_t count, size_t countBytes)
+{
+	for(size_t b=0;b<countBytes;b++)
+		to[b] = (uint8_t)(count >> (8 * b));
+}
+
+inline uint64_t getCount(const uint8_t* from, size_t countBytes)
+{
+	uint64_t count = 0;
+	for(size_t b=0;b<countBytes;b++)
+		count |= (uint64_t)from[b] << (8 * b);
+	return count;
+}
+
+}
+
+
+/**
+ * Writes the database from a number of sources that each see a disjoint set of kmers in ascending order (the
+ * partitions) - in two parallel passes:
+ *  - every source streams its records into a file of its own and counts them per prefix (add, from the source's thread)
+ *  - the prefix space is cut into one range per source, every range is merged from the sources and written to its
+ *    place in the database by a thread of its own (write)
+ *
+ * estimatedKmers: (an upper bound of) the number of distinct kmers - picks the size of the index
+ */
+template<class Mer>
+class KmerDatabaseWriter
+{
+	using MerCount = mer_count<Mer>;
+
+	/*
+	 * the records of a source and where every range starts in them
+	 */
+	struct SourceFile
+	{
+		string			 path;
+		std::ofstream	 out;
+		vector<MerCount> buffer;
+		uint64_t		 numOfRecords;
+		vector<uint64_t> rangeStarts;	// first record of every range (and the end)
+		size_t			 nextRange;		// the first range not started yet
+	};
+public:
+	KmerDatabaseWriter(const string& path, size_t k, bool canonical, size_t numOfSources, size_t estimatedKmers) :
+																			_path(path),
+																			_k(k),
+																			_canonical(canonical),
+																			_keyBytes(db::keyBytesFor(k)),
+																			_maxCount(0),
+																			_totalCount(0)
+	{
+		_indexBits = 0;
+		while(_indexBits < DatabaseHeader::maxIndexBits && _indexBits < 3 * _k && ((uint64_t)2 << _indexBits) <= estimatedKmers)
+			++_indexBits;
+		_prefixCounts.reset(new std::atomic<uint64_t>[((size_t)1 << _indexBits)]);
+		for(size_t p=0;p<((size_t)1 << _indexBits);p++)
+			_prefixCounts[p].store(0, std::memory_order_relaxed);
+
+		size_t numOfRanges = numOfSources ? numOfSources : 1;
+		for(size_t r=0;r<=numOfRanges;r++)
+			_rangeBounds.push_back(((uint64_t)r << _indexBits) / numOfRanges);
+		for(size_t i=0;i<numOfSources;i++)
+		{
+			unique_ptr<SourceFile> source(new SourceFile());
+			char suffix[64];
+			sprintf(suffix, ".part%lu", i);
+			source->path = _path + suffix;
+			source->out.open(source->path.c_str(), std::ios_base::binary | std::ios_base::trunc);
+			if(!source->out)
+				throw std::runtime_error("Could not create " + source->path);
+			source->numOfRecords = 0;
+			source->rangeStarts.assign(numOfRanges + 1, 0);
+			source->nextRange = 1;
+			_sources.push_back(std::move(source));
+		}
+	}
+
+	~KmerDatabaseWriter()
+	{
+		for(auto& source : _sources)
+			std::remove(source->path.c_str());
+	}
+
+	/*
+	 * the next record of source i - the kmers of a source have to come in ascending order
+	 */
+	void add(size_t i, const Mer& mer, uint64_t count)
+	{
+		SourceFile& source = *_sources[i];
+		uint8_t key[_maxKeyBytes];
+		db::keyOf(mer, _k, key);
+		uint64_t prefix = db::prefixOf(key, _keyBytes, 3 * _k, _indexBits);
+		_prefixCounts[prefix].fetch_add(1, std::memory_order_relaxed);
+		// the ranges starting at or before the prefix of this record start with it
+		while(source.nextRange + 1 < source.rangeStarts.size() && _rangeBounds[source.nextRange] <= prefix)
+			source.rangeStarts[source.nextRange++] = source.numOfRecords;
+		source.buffer.push_back(MerCount(mer, count));
+		++source.numOfRecords;
+		if(source.buffer.size() >= _bufferRecords)
+			flush(source);
+		updateMax(count);
+		_totalCount.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	/*
+	 * writes the database once every source is done
+	 */
+	void write()
+	{
+		for(auto& source : _sources)
+		{
+			flush(*source);
+			source->out.close();
+			// the ranges after the last record start (and end) at the end
+			while(source->nextRange < source->rangeStarts.size())
+				source->rangeStarts[source->nextRange++] = source->numOfRecords;
+		}
+
+		size_t numOfPrefixes = (size_t)1 << _indexBits;
+		vector<uint64_t> index(numOfPrefixes + 1, 0);
+		for(size_t p=0;p<numOfPrefixes;p++)
+			index[p+1] = index[p] + _prefixCounts[p].load(std::memory_order_relaxed);
+		_prefixCounts.reset();
+
+		DatabaseHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, DatabaseHeader::magicString(), sizeof(header.magic));
+		header.version = DatabaseHeader::currentVersion;
+		header.k = _k;
+		header.encoding = DatabaseHeader::encoding3Bit;
+		header.flags = _canonical ? DatabaseHeader::canonicalFlag : 0;
+		header.keyBytes = _keyBytes;
+		header.countBytes = db::countBytesFor(_maxCount.load());
+		header.indexBits = _indexBits;
+		header.numOfKmers = index[numOfPrefixes];
+		header.totalCount = _totalCount.load();
+		header.indexOffset = sizeof(DatabaseHeader);
+		header.recordsOffset = header.indexOffset + index.size() * sizeof(uint64_t);
+
+		int fd = ::open(_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0)
+			throw std::runtime_error("Could not create " + _path);
+		size_t recordBytes = header.keyBytes + header.countBytes;
+		bool ok = ftruncate(fd, header.recordsOffset + header.numOfKmers * recordBytes) == 0 &&
+				  writeAll(fd, &header, sizeof(header), 0) &&
+				  writeAll(fd, index.data(), index.size() * sizeof(uint64_t), header.indexOffset);
+
+		std::atomic<bool> failed(!ok);
+		vector<thread> threads;
+		for(size_t r=0;r+1<_rangeBounds.size() && ok;r++)
+		{
+			threads.push_back(thread([this, r, fd, &header, &index, &failed]()
+									 {
+										if(!writeRange(r, fd, header, index[_rangeBounds[r]]))
+											failed = true;
+									 }));
+		}
+		for(thread& t : threads)
+			t.join();
+		::close(fd);
+		if(failed)
+			throw std::runtime_error("Could not write " + _path);
+	}
+
+private:
+	void flush(SourceFile& source)
+	{
+		if(source.buffer.empty())
+			return;
+		source.out.write(reinterpret_cast<const char*>(source.buffer.data()), source.buffer.size() * sizeof(MerCount));
+		source.buffer.clear();
+	}
+
+	void updateMax(uint64_t count)
+	{
+		uint64_t max = _maxCount.load(std::memory_order_relaxed);
+		while(count > max && !_maxCount.compare_exchange_weak(max, count, std::memory_order_relaxed));
+	}
+
+	/*
+	 * merges range r of the sources (disjoint kmers, each one sorted) into the records starting at record first
+	 */
+	bool writeRange(size_t r, int fd, const DatabaseHeader& header, uint64_t first)
+	{
+		struct Cursor
+		{
+			std::ifstream	 in;
+			vector<MerCount> buffer;
+			size_t			 pos;
+			uint64_t		 remaining;
+		};
+		vector<unique_ptr<Cursor>> cursors;
+		for(auto& source : _sources)
+		{
+			unique_ptr<Cursor> c(new Cursor());
+			c->in.open(source->path.c_str(), std::ios_base::binary);
+			c->in.seekg(source->rangeStarts[r] * sizeof(MerCount));
+			c->pos = 0;
+			c->remaining = source->rangeStarts[r+1] - source->rangeStarts[r];
+			cursors.push_back(std::move(c));
+		}
+		auto fill = [](Cursor& c) -> bool
+		{
+			if(c.pos < c.buffer.size())
+				return true;
+			size_t len = c.remaining < _bufferRecords ? c.remaining : _bufferRecords;
+			c.buffer.resize(len);
+			c.pos = 0;
+			if(len)
+				c.in.read(reinterpret_cast<char*>(c.buffer.data()), len * sizeof(MerCount));
+			c.remaining -= len;
+			return len > 0;
+		};
+
+		size_t recordBytes = header.keyBytes + header.countBytes;
+		vector<uint8_t> out;
+		out.reserve(_bufferRecords * recordBytes);
+		uint64_t offset = header.recordsOffset + first * recordBytes;
+		while(true)
+		{
+			// few sources - a linear scan for the smallest head is as good as a heap
+			Cursor* next = nullptr;
+			for(auto& c : cursors)
+			{
+				if(fill(*c) && (!next || c->buffer[c->pos].mer < next->buffer[next->pos].mer))
+					next = c.get();
+			}
+			if(!next)
+				break;
+			const MerCount& m = next->buffer[next->pos++];
+			size_t at = out.size();
+			out.resize(at + recordBytes);
+			db::keyOf(m.mer, _k, &out[at]);
+			db::putCount(&out[at + header.keyBytes], m.count, header.countBytes);
+			if(out.size() >= _bufferRecords * recordBytes)
+			{
+				if(!writeAll(fd, out.data(), out.size(), offset))
+					return false;
+				offset += out.size();
+				out.clear();
+			}
+		}
+		return writeAll(fd, out.data(), out.size(), offset);
+	}
+
+	static bool writeAll(int fd, const void* data, size_t len, uint64_t offset)
+	{
+		const char* p = static_cast<const char*>(data);
+		while(len)
+		{
+			ssize_t written = pwrite(fd, p, len, offset);
+			if(written <= 0)
+				return false;
+			p += written;
+			len -= written;
+			offset += written;
+		}
+		return true;
+	}
+
+private:
+	static const size_t _maxKeyBytes = (3 * Mer::maxK + 7) / 8;
+	static const size_t _bufferRecords = 1 << 14;
+
+	string							 _path;
+	size_t							 _k;
+	bool							 _canonical;
+	size_t							 _keyBytes;
+	size_t							 _indexBits;
+	std::atomic<uint64_t>			 _maxCount;
+	std::atomic<uint64_t>			 _totalCount;
+	unique_ptr<std::atomic<uint64_t>[]> _prefixCounts;
+	vector<uint64_t>				 _rangeBounds;	// first prefix of every range (and the end)
+	vector<unique_ptr<SourceFile>>	 _sources;
+};
+
+
+/**
+ * A written database, mapped - count is a lookup in the index and a binary search among the records under the prefix
+ */
+class KmerDatabase
+{
+public:
+	KmerDatabase(const string& path) : _file(new io::MappedFile(path))
+	{
+		if(_file->size() < sizeof(DatabaseHeader))
+			throw std::runtime_error(path + " is not a kmer database!");
+		memcpy(&_header, _file->data(), sizeof(_header));
+		if(memcmp(_header.magic, DatabaseHeader::magicString(), sizeof(_header.magic)) != 0)
+			throw std::runtime_error(path + " is not a kmer database!");
+		if(_header.version != DatabaseHeader::currentVersion || _header.encoding != DatabaseHeader::encoding3Bit)
+			throw std::runtime_error(path + " is of an unsupported version!");
+		_recordBytes = _header.keyBytes + _header.countBytes;
+		// every offset is checked against the size before it is added to, so a corrupt header can not overflow them
+		uint64_t size = _file->size();
+		uint64_t indexBytes = (((uint64_t)1 << std::min<uint32_t>(_header.indexBits, DatabaseHeader::maxIndexBits)) + 1) *
+							  sizeof(uint64_t);
+		if(_header.k == 0 || _header.k > mer256::maxK ||
+		   _header.indexBits > DatabaseHeader::maxIndexBits || _header.indexBits > 3 * _header.k ||
+		   _header.keyBytes != db::keyBytesFor(_header.k) || _header.countBytes == 0 || _header.countBytes > 8 ||
+		   _header.indexOffset < sizeof(DatabaseHeader) || _header.indexOffset > size ||
+		   _header.indexOffset + indexBytes > _header.recordsOffset || _header.recordsOffset > size ||
+		   _header.numOfKmers > (size - _header.recordsOffset) / _recordBytes)
+			throw std::runtime_error(path + " is truncated or corrupt!");
+		_index = reinterpret_cast<const uint64_t*>(_file->data() + _header.indexOffset);
+		_records = reinterpret_cast<const uint8_t*>(_file->data() + _header.recordsOffset);
+		size_t tail = _file->size() - _header.recordsOffset;
+		_wideRecords = tail >= _maxKeyBytes ? (tail - _maxKeyBytes) / _recordBytes + 1 : 0;
+		_file->adviseRandom();
+	}
+
+	size_t	 k() const {return _header.k;}
+	bool	 canonical() const {return _header.flags & DatabaseHeader::canonicalFlag;}
+	uint64_t numOfKmers() const {return _header.numOfKmers;}
+	uint64_t totalCount() const {return _header.totalCount;}
+	const DatabaseHeader& header() const {return _header;}
+
+	/*
+	 * count of the kmer (its canonical form for a canonical database), 0 if it is not in there
+	 */
+	uint64_t count(const string& kmer) const
+	{
+		Key key;
+		keyOf(kmer, key);
+		return count(key.bytes);
+	}
+
+	/*
+	 * same with the key already encoded (a buffer of at least 32 bytes)
+	 */
+	uint64_t count(const uint8_t* key) const
+	{
+		uint64_t prefix = db::prefixOf(key, _header.keyBytes, 3 * _header.k, _header.indexBits);
+		return find(key, _index[prefix], _index[prefix + 1]);
+	}
+
+	/*
+	 * counts of a batch of kmers in the order of the kmers. The lookups go a group at a time so the cache misses of a
+	 * group overlap instead of following each other: the index entries of the whole group are prefetched, then the
+	 * first records under them, then the keys are compared
+	 */
+	void count(const vector<string>& kmers, vector<uint64_t>& counts) const
+	{
+		counts.resize(kmers.size());
+		Key keys[_groupSize];
+		uint64_t prefixes[_groupSize];
+		uint64_t lo[_groupSize];
+		uint64_t hi[_groupSize];
+		for(size_t first=0;first<kmers.size();first+=_groupSize)
+		{
+			size_t len = kmers.size() - first < _groupSize ? kmers.size() - first : _groupSize;
+			for(size_t i=0;i<len;i++)
+			{
+				keyOf(kmers[first + i], keys[i]);
+				prefixes[i] = db::prefixOf(keys[i].bytes, _header.keyBytes, 3 * _header.k, _header.indexBits);
+				__builtin_prefetch(_index + prefixes[i]);
+			}
+			for(size_t i=0;i<len;i++)
+			{
+				lo[i] = _index[prefixes[i]];
+				hi[i] = _index[prefixes[i] + 1];
+				__builtin_prefetch(_records + lo[i] * _recordBytes);
+			}
+			for(size_t i=0;i<len;i++)
+				counts[first + i] = find(keys[i].bytes, lo[i], hi[i]);
+		}
+	}
+
+	/*
+	 * fn(kmer, count) for every record in key order
+	 */
+	template<class Fn>
+	void forEach(Fn fn) const
+	{
+		for(uint64_t i=0;i<_header.numOfKmers;i++)
+		{
+			const uint8_t* record = _records + i * _recordBytes;
+			fn(db::decodeKey(record, _header.k), db::getCount(record + _header.keyBytes, _header.countBytes));
+		}
+	}
+
+private:
+	static const size_t _maxKeyBytes = (3 * mer256::maxK + 7) / 8;
+	static const size_t _groupSize = 16;
+	static const size_t _scanLength = 8;
+
+	struct Key
+	{
+		uint8_t bytes[_maxKeyBytes];
+	};
+
+	/*
+	 * the key to look up (the canonical one for a canonical database)
+	 */
+	inline void keyOf(const string& kmer, Key& key) const
+	{
+		if(kmer.size() != _header.k)
+			throw std::runtime_error("The kmer to look up has to be of length k!");
+		if(!canonical())
+		{
+			db::keyOf(kmer, key.bytes);
+			return;
+		}
+		Key rc;
+		db::keysOf(kmer, key.bytes, rc.bytes);
+		if(db::compareKeys(rc.bytes, key.bytes, _header.keyBytes) < 0)
+			key = rc;
+	}
+
+	/*
+	 * the count of the key among the records [lo, hi) - binary search down to a few records, those are compared
+	 */
+	inline uint64_t find(const uint8_t* key, uint64_t lo, uint64_t hi) const
+	{
+		while(hi - lo > _scanLength)
+		{
+			uint64_t mid = lo + (hi - lo) / 2;
+			int cmp = db::compareKeys(_records + mid * _recordBytes, key, _header.keyBytes);
+			if(cmp == 0)
+				return db::getCount(_records + mid * _recordBytes + _header.keyBytes, _header.countBytes);
+			if(cmp < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for(uint64_t r=lo;r<hi;r++)
+		{
+			const uint8_t* record = _records + r * _recordBytes;
+			if(db::keyEquals(record, key, _header.keyBytes, r < _wideRecords))
+				return db::getCount(record + _header.keyBytes, _header.countBytes);
+		}
+		return 0;
+	}
+
+	unique_ptr<io::MappedFile> _file;
+	DatabaseHeader			   _header;
+	size_t					   _recordBytes;
+	const uint64_t*			   _index;
+	const uint8_t*			   _records;
+	uint64_t				   _wideRecords;	// the records readable for 32 bytes
+};
+
+}
+
+#endif
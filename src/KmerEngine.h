@@ -5,18 +5,24 @@
 #include <MerMap.h>
 #include <FileSerializer.h>
 #include <FileIO.h>
+#include <WorkerPool.h>
+#include <CountingStage.h>
 #include <memory>
+#include <algorithm>
+#include <string>
+#include <map>
+#include <limits>
 #include <cmath>
 #include <cstdlib>
 #include <cstdio>
 
 using io::FileReader;
 using io::InputBuffer;
+using io::MappedFile;
 using std::unique_ptr;
 using kmers::Chunk;
 using kmers::Memory;
 
-using std::unordered_set;
 
 using serialization::Encoded;
 using serialization::FileSerializer;
@@ -26,223 +32,318 @@ namespace kmers
 {
 
 
-class KmerResultCollector
+/*
+ * Stream: the file is read block by block through FileReader (ifstream into freshly allocated buffers)
+ * Mmap:   the file is mapped and the counters work on chunks pointing straight into the mapping
+ * Pread:  ioThreads threads read the blocks with pread at their offsets (PreadFileReader), the engine parses them in file
+ *         order as they come in - for storage that needs several reads in flight. Compressed files are streamed
+ */
+enum class InputMode
 {
-	using Result = vector<mer_count>;
-
-public:
-	// n is the top most count strings
-	KmerResultCollector(size_t n, size_t k) : _n(n), _k(k),_hc(0,0), _totalKmerCount(0), _database(k)
-	{
-	}
-
-	KmerResultCollector(size_t n, size_t k,  HashTableConfig hc) : _n(n), _k(k), _hc(hc), _totalKmerCount(0), _database(k)
-	{
-		_database.reserve(hc.initialSize);
-		_database.reserve(hc.maxLoadFactor);
-	}
-
-	void setHashTableConfig(HashTableConfig hc)
-	{
-		_hc = hc;
-		_database.reserve(hc.initialSize);
-		_database.reserve(hc.maxLoadFactor);
-	}
+	Stream,
+	Mmap,
+	Pread
+};
 
+/*
+ * format: layout of the input file (see SequenceParser)
+ * numOfPartitions: number of hash partitions (and aggregator threads) of the kmer space, 0 means one per worker
+ * canonical: count a kmer and its reverse complement together (reads from both strands)
+ * approximate: Count-Min sketch counting in sketchMemory bytes (all workers together) aiming for an error of at most
+ * sketchError times the total kmer count - top n and point counts are estimates, nothing is spilled
+ * prefilter: (exact mode) keep the kmers seen only once out of the tables with a Bloom filter of at most prefilterMemory
+ * bytes - the counts are off by one for its false positives and the kmers seen once are never reported. fixup: count the
+ * input again for the exact counts of the top n
+ * sharedTable: (exact mode) all the workers count into one lock-free table instead of their own ones merged by the
+ * partitions - kept in memory as a whole, nothing is spilled
+ * maxMemory: bytes the engine may hold (0: half of the physical memory) - the tables are sized from it and the partitions
+ * only spill once their next growth would not fit
+ * databasePath: (exact mode) write every kmer with its count to a KmerDatabase there (empty: none)
+ * histogramPath: (exact mode) write the abundance histogram of the kmers there (empty: none, see Histogram::write)
+ * metricsPath: write the Metrics of the run there as json by writeMetrics (empty: none). metricsInterval: print a
+ * snapshot of them to stderr every that many seconds while counting (0: never)
+ * ioThreads: the reading threads of InputMode::Pread
+ * spillPrefix: the spills of the partitions go to <spillPrefix>_<k>_<partition>_<run> (a directory in it is not created)
+ * workers: count on this pool (shared with other engines, its size is the thread count then) instead of one of the
+ * engine's own. out: where the engine reports its progress (null: cout)
+ */
+struct EngineConfig
+{
+	EngineConfig() : format(InputFormat::Auto), inputMode(InputMode::Stream), numOfPartitions(0), canonical(false),
+					 approximate(false), sketchMemory(256 << 20), sketchError(1e-6),
+					 prefilter(false), prefilterMemory(1 << 30), fixup(false),
+					 sharedTable(false), maxMemory(0), metricsInterval(0), ioThreads(4),
+					 spillPrefix("map"), workers(nullptr), out(nullptr) {}
+	InputFormat format;
+	InputMode inputMode;
+	size_t	  numOfPartitions;
+	bool	  canonical;
+	bool	  approximate;
+	size_t	  sketchMemory;
+	double	  sketchError;
+	bool	  prefilter;
+	size_t	  prefilterMemory;
+	bool	  fixup;
+	bool	  sharedTable;
+	size_t	  maxMemory;
+	std::string databasePath;
+	std::string histogramPath;
+	std::string metricsPath;
+	double	  metricsInterval;
+	size_t	  ioThreads;
+	std::string spillPrefix;
+	WorkerPool* workers;
+	std::ostream* out;
+};
 
-	MerMap& GlobalDataBase() {return _database;}
 
-	vector<pair<string, size_t>> getResult(const vector<SerializationInfo>&  serializationInfos)
+/*
+ * Reads the input and feeds its blocks to the workers - the counting itself (and the key width it is compiled for)
+ * is behind the CountingStage picked for k.
+ *
+ * Several k can be counted in the same pass: every k gets a stage of its own (tables, partitions, spills, database and
+ * results), the input is read, parsed and scanned into base codes once per block and every stage rolls its own window
+ * over each piece of codes while it is in L1. The database (histogram) of a k goes to databasePath.k<k>
+ * (histogramPath.k<k>) then.
+ */
+class KmerEngine
+{
+public:
+	KmerEngine(const std::string& filePath, int k, int n, int threadCount, const EngineConfig& config = EngineConfig()) :
+																			 KmerEngine(filePath, vector<size_t>(1, k), n, threadCount, config) {}
+
+	KmerEngine(const std::string& filePath, const vector<size_t>& ks, int n, int threadCount, const EngineConfig& config = EngineConfig()) :
+																			 _config(config),
+																			 _filePath(filePath),
+																			 _budget(config.maxMemory),
+																			 _ks(ks),
+																			 _n(n),
+																			 _numOfCountersCreated(0),
+																			 _maxThreadedCounters(config.workers ? config.workers->size() : std::max(threadCount, 1)),
+																			 _fileReader(openInput()),
+																			 _parser(config.format),
+																			 _pendingOpen(false)
 	{
-		// combine the results
-		cout << "Combining results...\n";
-		vector<Result> results;
-		for(int i=0;i<serializationInfos.size();i++)
+		if(_ks.empty())
+			throw std::runtime_error("No kmer length to count!");
+		for(size_t i=0;i<_ks.size();i++)
+		{
+			if(std::find(_ks.begin(), _ks.begin() + i, _ks[i]) != _ks.begin() + i)
+				throw std::runtime_error("The kmer lengths have to be distinct!");
+		}
+		size_t blksize = _fileReader->blocksize();
+		size_t  filesize = _fileReader->filesize();
+		size_t numOfStages = _ks.size();
+
+		size_t numOfPartitions = _config.numOfPartitions ? _config.numOfPartitions : _maxThreadedCounters;
+		// there are at most as many distinct kmers as bases (the stage cuts it to the budget)
+		size_t bases = _fileReader->compressed() ? filesize * 4 : filesize;
+
+		// the input buffers going round between the reader and the workers: the blocks queued up for the workers and
+		// counted by them, the one parsed ahead and the one being parsed, the ones on the reader's side
+		_numOfInputBuffers = _maxThreadedCounters * (_queuedBlocksPerWorker + 1) + 2 + _fileReader->buffersInFlight();
+		_inputReserved = _numOfInputBuffers * _fileReader->bufferSize();
+		_budget.reserve(_inputReserved);
+		_maxK = *std::max_element(_ks.begin(), _ks.end());
+		if(numOfStages > 1)
 		{
-			const SerializationInfo& si = serializationInfos[i];
-			MerMap mermap(_k);
-			FileSerializer::read(mermap, si);
-			_totalKmerCount += mermap.totalCount();
-			Result res = mermap.extract(_n);
-			results.push_back(res);
-			mermap.clear();
+			_scanners.resize(_maxThreadedCounters);
+			_sinks.resize(_maxThreadedCounters);
+			for(size_t i=0;i<_maxThreadedCounters;i++)
+				_scanners[i].reset(new BaseScanner());
 		}
 
-		// we need to take care of what we have not persisted
-		results.push_back(_database.extract(_n));
-		_totalKmerCount+=_database.totalCount();
+		_numOfBlocks = filesize / blksize+1;
+		if(filesize%blksize == 0)
+			_numOfBlocks--;
 
-		// identify all strings
-		cout << "Starting to populate the needToLookAtSet" << endl;
-		unordered_set<mer_encoded, mer_encoded_hash> needToLookAtSet;
-		for(Result& res : results)
+		CountingConfig cc;
+		cc.numOfWorkers = _maxThreadedCounters;
+		cc.numOfPartitions = numOfPartitions;
+		// the worker tables are flushed once they reach _workerFlushThreshold - leave room for one more block so they never rehash
+		cc.workerConfig = HashTableConfig(_workerFlushThreshold + blksize, 0.7f);
+		cc.workerFlushThreshold = _workerFlushThreshold;
+		cc.maxPendingBatches = _maxThreadedCounters;
+		cc.canonical = _config.canonical;
+		cc.approximate = _config.approximate;
+		cc.sketchMemory = std::min(_config.sketchMemory, _budget.limit() / 2) / cc.numOfWorkers / numOfStages;
+		cc.sketchError = _config.sketchError;
+		if(_config.prefilter && !_config.approximate)
 		{
-			for(const mer_count& m : res)
-			{
-				needToLookAtSet.insert(m.mer);
-			}
-			// memory deallocation
-			res.clear();
-			res.reserve(0);
+			// ~16 bits per kmer (a compressed file holds a few times more bases than its size)
+			size_t bits = bases * _prefilterBitsPerKmer;
+			if(bits < _minPrefilterBits)
+				bits = _minPrefilterBits;
+			cc.prefilterBits = std::min(bits, std::min(_config.prefilterMemory, _budget.limit() / 4) * 8 / numOfStages);
+			cc.fixup = _config.fixup;
 		}
-		cout << "needToLookAtSet size: " << needToLookAtSet.size() << endl;
-		results.clear();
-		results.reserve(0);
-		// DEBUG
-		/*
-		for(const mer_encoded& m : needToLookAtSet)
+		cc.budget = &_budget;
+		cc.numOfStages = numOfStages;
+		if(!_config.metricsPath.empty() || _config.metricsInterval > 0)
 		{
-			cout << "set: " << decode(m, _k) << std::endl;
+			_metrics.reset(new Metrics(_maxThreadedCounters, &_budget));
+			cc.metrics = _metrics.get();
 		}
-		*/
-		///
-
-		// second pass - gather from the files all the needToLookAtSet strings
-		cout << "Second pass\n";
-		MerMap unifiedMap(_k);
-		for(int i=0;i<serializationInfos.size();i++)
+		if(!_config.databasePath.empty() && _config.approximate)
+			throw std::runtime_error("The kmer database needs exact counts!");
+		if(!_config.histogramPath.empty() && _config.approximate)
+			throw std::runtime_error("The histogram needs exact counts!");
+		cc.histogram = !_config.histogramPath.empty();
+		cc.spillPrefix = _config.spillPrefix;
+
+		for(size_t k : _ks)
 		{
-			const SerializationInfo& si = serializationInfos[i];
-			MerMap mermap(_k);
-			FileSerializer::read(mermap, si);
-			Result res = mermap.extract(needToLookAtSet);
-			for(const mer_count& m : res)
+			cc.partitionConfig = HashTableConfig(std::min(calculateInitialHashTableSize(filesize, k), bases) / numOfPartitions, 0.7f);
+			if(_config.sharedTable && !_config.approximate)
 			{
-				unifiedMap[m.mer]+=m.count;
+				cc.sharedTable = true;
+				cc.sharedTableSize = std::min(calculateInitialHashTableSize(filesize, k), bases);
 			}
-			res.clear(); res.reserve(0);
-			mermap.clear();
+			cc.databasePath = _config.databasePath;
+			if(!cc.databasePath.empty() && numOfStages > 1)
+				cc.databasePath += ".k" + std::to_string(k);
+			_databasePaths.push_back(cc.databasePath);
+			_histogramPaths.push_back(_config.histogramPath);
+			if(!_config.histogramPath.empty() && numOfStages > 1)
+				_histogramPaths.back() += ".k" + std::to_string(k);
+			_stages.push_back(makeCountingStage(k, _n, cc));
 		}
+		_results.resize(numOfStages);
+		_totalKmerCounts.resize(numOfStages, 0);
+		_collected.resize(numOfStages, false);
+	}
+
+	~KmerEngine()
+	{
+		_stages.clear();
+		_budget.release(_inputReserved);
+	}
+
 
-		Result res = _database.extract(needToLookAtSet);
-		for(const mer_count& m : res)
+	void start()
+	{
+		if(_metrics)
+			_metrics->startReporting(_config.metricsInterval, std::cerr);
+		for(auto& stage : _stages)
 		{
-			unifiedMap[m.mer]+=m.count;
+			stage->start();
+			_counting.push_back(stage.get());
 		}
-		res.clear(); res.reserve(0);
-
-		needToLookAtSet.clear();
-		needToLookAtSet.reserve(0);
-		cout << "Second pass done\n";
-		cout << "Extracing final results...\n";
-		Result final = unifiedMap.extract(_n);
-		cout << "Final size: " << final.size() << endl;
-		cout << "Extracted final results\n";
-
-		cout << "Unified map size: " << unifiedMap.size() << endl;
-		unifiedMap.clear();
-		unifiedMap.reserve(0);
-
-		//stringify results
-		cout << "Stringifying final results...\n";
-		vector<pair<string, size_t>> stringRes;
-		for(const auto& r : final)
+		countInput();
 		{
-			const mer_encoded& mem = r.mer;
-			size_t count = r.count;
-			string s = decode(mem, _k);
-			stringRes.push_back(make_pair(s, count));
+			StageTimer timer(_metrics ? &_metrics->finish : nullptr);
+			for(CountingStageBase* stage : _counting)
+				stage->finish();
 		}
-		final.clear(); final.reserve(0);
-		cout << "Final results are in string form.\n";
-
-		_database.clear();
-		_database.reserve(0);
-
-		//cout << "Number of strings: " << tmp.size() << endl;
 
-		return stringRes;
+		// only the stages that need it count the second pass
+		_counting.clear();
+		for(auto& stage : _stages)
+		{
+			if(stage->needsSecondPass())
+				_counting.push_back(stage.get());
+		}
+		if(!_counting.empty())
+		{
+			StageTimer timer(_metrics ? &_metrics->recount : nullptr);
+			out() << "Recounting the candidates...\n";
+			for(CountingStageBase* stage : _counting)
+				stage->startSecondPass();
+			_fileReader = openInput();
+			_parser = SequenceParser(_config.format);
+			_pendingOpen = false;
+			countInput();
+			for(CountingStageBase* stage : _counting)
+				stage->finish();
+		}
+		_counting.clear();
 	}
 
-	unsigned long long totalKmerCount() const {return _totalKmerCount;}
+	const vector<size_t>& ks() const {return _ks;}
 
-private:
-
-
-private:
-	size_t _n;
-	size_t _k;
-	unsigned long long _totalKmerCount;
-	HashTableConfig _hc;
-	MerMap _database;
-};
+	/*
+	 * the results of the first k (the only one usually)
+	 */
+	const vector<pair<string, size_t>>& getResults() {return getResults(_ks.front());}
 
-
-class KmerEngine
-{
-	using KmerCounterThreadedPtr = shared_ptr<KmerCounterThreaded>;
-	using HashTableConfigPtr = unique_ptr<HashTableConfig>;
-public:
-	KmerEngine(const std::string& filePath, int k, int n, int threadCount) : _k(k),
-																			 _n(n),
-																			 _numOfCountersCreated(0),
-																			 _maxThreadedCounters(threadCount),
-																			 _fileReader(filePath),
-																			 _finishedCounting(false),
-																			 _resultCollector(n, k)
+	const vector<pair<string, size_t>>& getResults(size_t k)
 	{
-		size_t blksize = _fileReader.blocksize();
-		size_t  filesize = _fileReader.filesize();
-
-		size_t recommendedbuckets = calculateInitialHashTableSize(filesize, _k);
-		_resultCollector.setHashTableConfig(HashTableConfig(recommendedbuckets, 5));
-
-		_numOfBlocks = filesize / blksize+1;
-		if(filesize%blksize == 0)
-			_numOfBlocks--;
-		_hashTableConfig = HashTableConfigPtr(new HashTableConfig(blksize/10, 12));
-	}
-
-
-	void start()
-	{
-		// async operation - we started reading the file into blocks which are placed into a queue
-		_fileReader.startReadingBlocks();
-
-		_threadReconciliation = thread(&KmerEngine::startReconciliation, this);
-
-		InputBuffer buffer;
-		while(!buffer.isEndofStream())
+		size_t i = indexOf(k);
+		if(!_collected[i])
 		{
-			_fileReader.getNextBlock(buffer);
-
-		// might block below
-			if(_prevBuffer.getBuffer() == nullptr && !buffer.isEndofStream())
+			_collected[i] = true;
+			CountingStageBase& stage = *_stages[i];
+			if(_ks.size() > 1)
+				out() << "k=" << k << ": ";
+			if(_config.approximate)
+				out() << "Combining the worker sketches...\n";
+			else if(_config.sharedTable)
+				out() << "Collecting the shared table...\n";
+			else
+				out() << "Combining results of " << stage.numOfPartitions() << " partitions...\n";
 			{
-				//noop wait for the second buffer
+				StageTimer timer(_metrics ? &_metrics->collect : nullptr);
+				_results[i] = stage.results();
 			}
-			else
-				createCounter(buffer);
-
-			// if last section then we have to deal with it now
-			if(_prevBuffer.getBuffer()!=nullptr && buffer.isEndofStream())
+			_totalKmerCounts[i] = stage.totalKmerCount();
+			out() << "Total kmers: " << _totalKmerCounts[i];
+			// none in an input shorter than k
+			if(_parser.format() == InputFormat::Raw && !_fileReader->compressed())
+				out() << " Expected: " << (_fileReader->filesize() >= k ? _fileReader->filesize() - k + 1 : 0);
+			out() << endl;
+			if(!_databasePaths[i].empty())
+				out() << "Database written to " << _databasePaths[i] << "\n";
+			if(!_histogramPaths[i].empty())
 			{
-				// need to do this so we will process just one buffer inside createCounter
-				_prevBuffer.setBuffer(nullptr);
-				createCounter(buffer);
+				stage.histogram().write(_histogramPaths[i]);
+				out() << "Histogram written to " << _histogramPaths[i] << "\n";
 			}
-			_prevBuffer = buffer;
+			out() << "Memory: peak " << (_budget.peak() >> 20) << " MB of the " << (_budget.limit() >> 20) << " MB budget\n";
 		}
-		_finishedCounting.store(true);
-
-		_threadReconciliation.join();
+		return _results[i];
 	}
 
-	const vector<pair<string, size_t>>& getResults()
+	/*
+	 * the final metrics report (once the results are collected) - nothing without a metricsPath
+	 */
+	void writeMetrics()
 	{
-		if(_result.empty())
+		if(!_metrics)
+			return;
+		_metrics->stopReporting();
+		if(!_config.metricsPath.empty())
 		{
-			_result = _resultCollector.getResult(_serializationInfos);
-			deleteSerializedFiles();
-			//cout << "Number of counters created: " << _numOfCountersCreated << endl;
-			auto totalkmers = _resultCollector.totalKmerCount();
-			cout << "Total kmers: " << totalkmers << " Expected: " <<  _fileReader.filesize()-_k+1 << endl;
-			//assert(totalkmers == _fileReader.filesize()-_k+1);
+			_metrics->write(_config.metricsPath);
+			out() << "Metrics written to " << _config.metricsPath << "\n";
 		}
-		return _result;
 	}
 
-	unsigned long long totalKmerCount() const {return _resultCollector.totalKmerCount();}
+	unsigned long long totalKmerCount() const {return _totalKmerCounts.front();}
+	unsigned long long totalKmerCount(size_t k) const {return _totalKmerCounts[indexOf(k)];}
+
+	/*
+	 * approximate mode: estimated count of the kmer (by the stage of its length) and the bound on its overshoot
+	 * (holding with errorConfidence) - the loosest one of all the k
+	 */
+	size_t estimate(const string& kmer) const
+	{
+		auto it = std::find(_ks.begin(), _ks.end(), kmer.size());
+		return _stages[it == _ks.end() ? 0 : it - _ks.begin()]->estimate(kmer);
+	}
+	unsigned long long errorBound() const
+	{
+		unsigned long long bound = 0;
+		for(const auto& stage : _stages)
+			bound = std::max(bound, stage->errorBound());
+		return bound;
+	}
+	double errorConfidence() const
+	{
+		double confidence = 1.0;
+		for(const auto& stage : _stages)
+			confidence = std::min(confidence, stage->errorConfidence());
+		return confidence;
+	}
 
 private:
 	size_t calculateInitialHashTableSize(size_t filesize, size_t kmerLength)
@@ -258,101 +359,302 @@ private:
 
 	}
 
-	void createCounter(const InputBuffer& buffer)
+	size_t indexOf(size_t k) const
 	{
-		unique_lock<mutex> lock(_mutexOnCounters);
-		while(_counters.size()>=_maxThreadedCounters)
-			_condvarOnCounterSize.wait(lock);
-
-		++_numOfCountersCreated;
-		const char* begin = buffer.getBuffer();
-		const char* end = begin + buffer.getLen();
-		Chunk prevChunk(_prevBuffer.getBuffer(), _prevBuffer.getBuffer() + _prevBuffer.getLen());
-		Chunk newChunk(begin, end);
-		if(prevChunk.begin() == nullptr && buffer.isEndofStream())
-			_counters.push_back(KmerCounterThreadedPtr(new KmerCounterThreaded(newChunk, _k, _n, *_hashTableConfig, true)));
-		else if(prevChunk.begin() != nullptr)		// there is a previous one
-			_counters.push_back(KmerCounterThreadedPtr(new KmerCounterThreaded(prevChunk, newChunk, _k, _n, *_hashTableConfig, true)));
-
-		_condvarOnCounterSize.notify_one();
+		auto it = std::find(_ks.begin(), _ks.end(), k);
+		if(it == _ks.end())
+			throw std::runtime_error("The kmer length was not counted!");
+		return it - _ks.begin();
 	}
 
-	void startReconciliation()
+	std::ostream& out() const {return _config.out ? *_config.out : cout;}
+
+	void countInput()
 	{
-		bool keepGoing = true;
-		while(true)
+		unique_ptr<WorkerPool> own;
+		if(!_config.workers)
+			own.reset(new WorkerPool(_maxThreadedCounters, _maxThreadedCounters * _queuedBlocksPerWorker));
+		WorkerPool& pool = _config.workers ? *_config.workers : *own;
+
+		try
+		{
+			// a compressed file can only be streamed through its decoder
+			if(_config.inputMode == InputMode::Mmap && !_fileReader->compressed())
+				countMapped(pool);
+			else
+				countStreamed(pool);
+		}
+		catch(...)
 		{
-			keepGoing = reconcileCounters();
-			if(!keepGoing)
-				break;
+			// the tasks in flight still look at the stages
+			pool.waitIdle(_tasks);
+			throw;
 		}
+
+		// only the blocks of this engine (the pool might be shared)
+		pool.waitIdle(_tasks);
+	}
+
+	unique_ptr<FileReader> openInput() const
+	{
+		return io::openFileReader(_filePath, 1<<15, _config.inputMode == InputMode::Pread ? std::max<size_t>(_config.ioThreads, 2) : 1);
 	}
 
-	bool reconcileCounters()
+	void countStreamed(WorkerPool& pool)
 	{
-		unique_lock<mutex> lock(_mutexOnCounters);
-		while(_counters.empty())
+		// async operation - we started reading the file into blocks which are placed into a queue (compressed input is
+		// decoded on the same pool as the counting if it can be done in parallel)
+		_fileReader->startReadingBlocks(&pool, _metrics.get(), _numOfInputBuffers);
+		FileReader* reader = _fileReader.get();
+
+		// the blocks of a parallel reader come in any order - they are held back until the ones before them are parsed
+		// (the parser and the records crossing into the next block need the file order)
+		std::map<size_t, InputBuffer> early;
+		size_t next = 0;
+		bool endOfStream = false;
+		try
 		{
-			if(_finishedCounting.load() == false){
-				_condvarOnCounterSize.wait(lock);
+			while(!endOfStream)
+			{
+				InputBuffer buffer;
+				auto it = early.find(next);
+				if(it != early.end())
+				{
+					buffer = it->second;
+					early.erase(it);
+				}
+				else
+				{
+					_fileReader->getNextBlock(buffer);
+					if(buffer.getSequence() != next)
+					{
+						early.emplace(buffer.getSequence(), buffer);
+						continue;
+					}
+				}
+				++next;
+				endOfStream = buffer.isEndofStream();
+				// back to the reader once the block and the record crossing into it are counted
+				shared_ptr<const char> memory(buffer.getBuffer(), [reader](const char* p) {reader->recycle(p);});
+				feedBlock(pool, buffer.getBuffer(), buffer.getBuffer() + buffer.getLen(), memory);
 			}
-			else
-				return false;
 		}
-		// wait for it to finish
-		_counters.front()->threadHandle().join();
-		KmerCounterThreadedPtr& kc = _counters.front();
-		populateTopStrings(kc);
-
-		_counters.pop_front();
+		catch(...)
+		{
+			_pending.reset();
+			drainReader(early, next, endOfStream);
+			throw;
+		}
 
-		_condvarOnCounterSize.notify_one();
-		return true;
+		submitPending(pool);
+		_fileReader->waitReading();
+	}
 
+	/*
+	 * the input can not be counted any more (e.g. a malformed record): the blocks still to come go straight back to
+	 * the reader so it can get to the end of the file instead of waiting for buffers forever - or to the error it
+	 * stopped with (nothing comes after that, the error the counting stopped with is the one reported)
+	 */
+	void drainReader(std::map<size_t, InputBuffer>& early, size_t next, bool endOfStream)
+	{
+		// one past the last block once it is known, the blocks from next on taken from the reader so far
+		size_t end = endOfStream ? next : std::numeric_limits<size_t>::max();
+		size_t taken = early.size();
+		for(auto& p : early)
+		{
+			if(p.second.isEndofStream())
+				end = p.first + 1;
+			_fileReader->recycle(p.second.getBuffer());
+		}
+		early.clear();
+		try
+		{
+			while(next + taken < end)
+			{
+				InputBuffer buffer;
+				_fileReader->getNextBlock(buffer);
+				if(buffer.isEndofStream())
+					end = buffer.getSequence() + 1;
+				_fileReader->recycle(buffer.getBuffer());
+				++taken;
+			}
+		}
+		catch(...)
+		{
+		}
 	}
 
-	void populateTopStrings(const KmerCounterThreadedPtr& kc)
+	/*
+	 * zero copy path: the segments handed to the counters point straight into the mapping (the record going on in the
+	 * next block as well) - nothing is copied or allocated
+	 */
+	void countMapped(WorkerPool& pool)
 	{
-		if(_resultCollector.GlobalDataBase().size() > 1<<20)
+		_mappedFile.reset(new MappedFile(_fileReader->filepath()));
+		const char* data = _mappedFile->data();
+		size_t size = _mappedFile->size();
+		size_t blksize = _fileReader->blocksize();
+		// keep the kernel paging in a window ahead of the block we hand out
+		size_t readAhead = blksize * _readAheadBlocks;
+		_mappedFile->willNeed(0, readAhead);
+
+		for(size_t offset = 0; offset < size; offset += blksize)
 		{
-			char buff[512] = {0};
-			sprintf(buff, "map_%lu", _serializationInfos.size());
-			SerializationInfo si = FileSerializer::write(_resultCollector.GlobalDataBase(), buff);
-			_serializationInfos.push_back(si);
+			if(offset % readAhead == 0)
+				_mappedFile->willNeed(offset + readAhead, readAhead);
+			feedBlock(pool, data + offset, data + std::min(size, offset + blksize), shared_ptr<const char>());
+		}
+		submitPending(pool);
+	}
 
-			_resultCollector.GlobalDataBase().clear();
+	/*
+	 * runs the block through the parser and hands out the previous one - a block can only be handed out once the next
+	 * one is parsed (the kmers of its last record crossing into it)
+	 */
+	void feedBlock(WorkerPool& pool, const char* begin, const char* end, const shared_ptr<const char>& memory)
+	{
+		ParsedBlock block;
+		{
+			StageTimer timer(_metrics ? &_metrics->parse : nullptr);
+			timer.bytes(end - begin);
+			_parser.parse(begin, end, block);
 		}
+		if(_pending && _pendingOpen && block.continued)
+		{
+			_pending->next = block.segments.front();
+			_pending->nextMemory = memory;
+		}
+		submitPending(pool);
+		_pending.reset(new BlockTask());
+		_pending->segments.swap(block.segments);
+		_pending->chunkMemory = memory;
+		_pendingOpen = block.open;
+	}
 
+	void submitPending(WorkerPool& pool)
+	{
+		if(_pending && !_pending->segments.empty())
+			submitBlock(pool, *_pending);
+		_pending.reset();
+	}
 
-		kc->extractProcessingResult(_resultCollector.GlobalDataBase());
+	void submitBlock(WorkerPool& pool, const BlockTask& task)
+	{
+		++_numOfCountersCreated;
+		Metrics* metrics = _metrics.get();
+		if(_counting.size() == 1)
+		{
+			CountingStageBase* stage = _counting.front();
+			pool.submit(_tasks, [stage, task, metrics](size_t worker)
+						{
+							StageTimer timer(metrics ? &metrics->worker(worker) : nullptr);
+							timer.kmers(stage->count(worker, task));
+							if(metrics)
+								timer.bytes(bytesOf(task));
+						});
+		}
+		else
+		{
+			pool.submit(_tasks, [this, task, metrics](size_t worker)
+						{
+							StageTimer timer(metrics ? &metrics->worker(worker) : nullptr);
+							timer.kmers(countScanned(worker, task));
+							if(metrics)
+								timer.bytes(bytesOf(task));
+						});
+		}
+		if(metrics)
+			metrics->workQueue.sample(pool.queued());
 	}
 
-	void deleteSerializedFiles()
+	/*
+	 * several k: the block is scanned once and every piece of codes goes to the stages of all the k in turn - returns
+	 * the kmers of all of them
+	 */
+	size_t countScanned(size_t worker, const BlockTask& task)
 	{
-		for(const auto& si : _serializationInfos)
+		vector<CodeSink*>& sinks = _sinks[worker];
+		BaseScanner& scanner = *_scanners[worker];
+		sinks.clear();
+		try
 		{
-			std::remove(si.filename.c_str());
+			for(CountingStageBase* stage : _counting)
+				sinks.push_back(&stage->beginBlock(worker));
+			for(size_t i=0;i<task.segments.size();i++)
+			{
+				const Chunk& segment = task.segments[i];
+				for(CodeSink* sink : sinks)
+					sink->beginRecord();
+				scanner.scan(segment.begin(), segment.end(), [&sinks](const uint8_t* codes, size_t len)
+							 {
+								for(CodeSink* sink : sinks)
+									sink->countCodes(codes, len);
+							 });
+				// only the last segment goes on in the next block
+				size_t len = 0;
+				const uint8_t* next = nullptr;
+				if(i + 1 == task.segments.size())
+					next = scanner.prefix(task.next.begin(), task.next.end(), _maxK - 1, len);
+				for(CodeSink* sink : sinks)
+					sink->endRecord(next, len);
+			}
 		}
+		catch(...)
+		{
+			// the stages begun have to be done with the block (a shared table writer is held until then)
+			for(size_t i=0;i<sinks.size();i++)
+				_counting[i]->abortBlock(worker);
+			throw;
+		}
+		size_t kmers = 0;
+		for(size_t i=0;i<sinks.size();i++)
+			kmers += _counting[i]->endBlock(worker);
+		return kmers;
 	}
 
+	static size_t bytesOf(const BlockTask& task)
+	{
+		size_t bytes = 0;
+		for(const Chunk& segment : task.segments)
+			bytes += segment.size();
+		return bytes;
+	}
 
 private:
-	size_t _k;
+	static const size_t _readAheadBlocks = 64;
+	static const size_t _workerFlushThreshold = 1<<18;
+	static const size_t _queuedBlocksPerWorker = 4;
+	static const size_t _prefilterBitsPerKmer = 16;
+	static const size_t _minPrefilterBits = 1<<23;
+
+	EngineConfig _config;
+	std::string	 _filePath;
+	MemoryBudget _budget;
+	size_t		 _inputReserved;
+	size_t		 _numOfInputBuffers;
+	unique_ptr<Metrics> _metrics;
+
+	vector<size_t> _ks;
 	size_t _n;
 	size_t _numOfBlocks;
-	size_t _numOfCountersCreated;
+	atomic<size_t> _numOfCountersCreated;
 	size_t				_maxThreadedCounters;
-	atomic<bool>		_finishedCounting;
-	HashTableConfigPtr _hashTableConfig;
-	FileReader _fileReader;
-	condition_variable	 _condvarOnCounterSize;
-	mutex				 _mutexOnCounters;
-	list<KmerCounterThreadedPtr> _counters;
-	thread						_threadReconciliation;
-	KmerResultCollector			 _resultCollector;
-	vector<pair<string, size_t>> _result;
-	InputBuffer					 _prevBuffer;
-	vector<SerializationInfo>    _serializationInfos;
+	unique_ptr<FileReader> _fileReader;
+	unique_ptr<MappedFile> _mappedFile;
+	SequenceParser		_parser;
+	unique_ptr<BlockTask> _pending;		// parsed block waiting for the next one
+	bool				_pendingOpen;
+	vector<unique_ptr<CountingStageBase>> _stages;	// one per k
+	vector<CountingStageBase*> _counting;			// the stages counting the current pass
+	size_t				_maxK;
+	vector<unique_ptr<BaseScanner>> _scanners;		// per worker, with several k
+	vector<vector<CodeSink*>> _sinks;				// the stages a worker's block goes to
+	vector<string>		_databasePaths;
+	vector<string>		_histogramPaths;
+	vector<vector<pair<string, size_t>>> _results;
+	vector<unsigned long long> _totalKmerCounts;
+	vector<bool>		_collected;
+	WorkerPool::Group	_tasks;		// the blocks submitted to the workers
 };
 
 
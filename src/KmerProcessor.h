@@ -6,23 +6,39 @@
 namespace kmers
 {
 
+/*
+ * Mer: the key width of the counting tables - the default covers k <= 42
+ */
+template<class Mer = mer128>
 class KmerProcessor
 {
+	using Counter = KmerCounter<Mer>;
+	using MerCount = mer_count<Mer>;
 public:
 	KmerProcessor(const char* begin, size_t inputSize, int k, int n, int numOfThreads) : _begin(begin), _inputSize(inputSize), _processingDone(false), _k(k), _n(n), _numOfThreads(numOfThreads)
 	{
-		HashTableConfig hc(1000, 15);
+		HashTableConfig hc(1000, 0.7f);
 		for(int i=0;i<numOfThreads;i++)
 		{
-			_counters.push_back(KmerCounter(begin, begin+inputSize, k, n, hc));
+			_counters.push_back(Counter(k, n, hc));
 		}
 	}
 
 	// TODO maybe we want this to be async?
 	void process(vector<pair<string, size_t>>& results)
 	{
+		// every counter gets an equal slice of the input plus the rest of the input to roll into
+		const char* end = _begin + _inputSize;
+		size_t sliceSize = _inputSize / _counters.size() + 1;
 		for(int i=0;i<_counters.size();i++)
-			_threads.push_back(std::thread(&KmerCounter::process, std::ref(_counters[i])));
+		{
+			const char* sliceBegin = _begin + std::min(i*sliceSize, _inputSize);
+			const char* sliceEnd = _begin + std::min((i+1)*sliceSize, _inputSize);
+			_threads.push_back(std::thread([this, i, sliceBegin, sliceEnd, end]()
+											{
+												_counters[i].count(Chunk(sliceBegin, sliceEnd, false), Chunk(sliceEnd, end, false));
+											}));
+		}
 
 		for(int i=0;i<_threads.size();i++)
 			_threads[i].join();
@@ -36,37 +52,20 @@ public:
 
 protected:
 
-	void _collectMostCommons(vector<pair<string, size_t>>& results) const
+	void _collectMostCommons(vector<pair<string, size_t>>& results)
 	{
-		vector<pair<string, size_t>> all;
-		for(const KmerCounter& km : _counters)
-		{
-			vector<pair<string, size_t>> tmp;
-			km.getTopStrings(tmp);
-			std::copy(tmp.begin(),tmp.end(), back_inserter(all));
-		}
-		std::sort(all.begin(), all.end(), [](const pair<string, size_t>& lhs, const pair<string, size_t>& rhs)
-											{
-												if(lhs.second >= rhs.second)
-													return true;
-												else
-													return false;
-											});
-		// TODO refactor - extract method below
-		int count=0;
-		size_t prevSize = 0;
-		for(int i =0;i < all.size();i++)
-		{
-			const auto& tmp = all[i];
-			if(prevSize!=tmp.second)
-					count++;
-			prevSize = tmp.second;
-			if(count>_n)
-				break;
-
-			results.push_back(tmp);
-
-		}
+		// the slices are disjoint partitions of the kmer starts - every occurrence is counted by exactly one of them, so
+		// the union of the tables summed up holds the exact counts and its top n is exact. A kmer can still occur in
+		// several slices, the top n of the tables one by one would not be
+		vector<vector<MerCount>> batches(1);
+		for(Counter& km : _counters)
+			km.extractProcessingResult(batches);
+		MerMap<Mer> all(_k);
+		for(const MerCount& m : batches[0])
+			all[m.mer] += m.count;
+
+		for(const MerCount& m : all.extract(_n))
+			results.push_back(make_pair(decode(m.mer, _k), m.count));
 	}
 
 protected:
@@ -76,7 +75,7 @@ protected:
 	int					_n;
 	int					_numOfThreads;
 	bool				_processingDone;
-	vector<KmerCounter> _counters;
+	vector<Counter>		_counters;
 	vector<std::thread> _threads;
 };
 
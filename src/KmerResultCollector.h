@@ -0,0 +1,271 @@
+#ifndef KMERRESULTCOLLECTOR_H_
+#define KMERRESULTCOLLECTOR_H_
+
+#include <KmerCounter.h>
+#include <MerMap.h>
+#include <FileSerializer.h>
+#include <CountMinSketch.h>
+#include <FlatHashMap.h>
+#include <queue>
+#include <memory>
+
+using serialization::FileSerializer;
+using serialization::SerializationInfo;
+using serialization::RunReader;
+
+namespace kmers
+{
+
+
+template<class Mer>
+class KmerResultCollector
+{
+	using MerCount = mer_count<Mer>;
+	using Result = vector<MerCount>;
+
+public:
+	// n is the top most count strings
+	KmerResultCollector(size_t n, size_t k) : _n(n), _k(k),_hc(0,0), _totalKmerCount(0), _database(k)
+	{
+	}
+
+	KmerResultCollector(size_t n, size_t k,  HashTableConfig hc) : _n(n), _k(k), _hc(hc), _totalKmerCount(0), _database(k)
+	{
+		_database.max_load_factor(hc.maxLoadFactor);
+		_database.reserve(hc.initialSize);
+	}
+
+	void setHashTableConfig(HashTableConfig hc)
+	{
+		_hc = hc;
+		_database.max_load_factor(hc.maxLoadFactor);
+		_database.reserve(hc.initialSize);
+	}
+
+
+	MerMap<Mer>& GlobalDataBase() {return _database;}
+	size_t n() const {return _n;}
+
+	/*
+	 * exact top n of everything this collector has seen: the spilled runs plus what is still in the database.
+	 * The runs are sorted by the encoding so one streaming k-way merge over all of them (and the sorted database) sees
+	 * every kmer exactly once with its total count - the top n is kept on the fly.
+	 */
+	Result getResult(const vector<SerializationInfo>&  serializationInfos)
+	{
+		return getResult(serializationInfos, _n);
+	}
+
+	/*
+	 * same with the top n levels instead of the ones the collector was made for
+	 */
+	Result getResult(const vector<SerializationInfo>&  serializationInfos, size_t n)
+	{
+		return getResult(serializationInfos, n, [](const MerCount&) {});
+	}
+
+	/*
+	 * same while every distinct kmer goes to fn as well (in ascending order)
+	 */
+	template<class Fn>
+	Result getResult(const vector<SerializationInfo>&  serializationInfos, size_t n, Fn fn)
+	{
+		TopNSelector<MerCount, MerCountOf> selector(n);
+		merge(serializationInfos, [&selector, &fn](const MerCount& m) { selector.add(m); fn(m); });
+		return selector.result();
+	}
+
+	/*
+	 * streams every distinct kmer with its total count to fn in ascending order of the encoding - the database is
+	 * drained in the process
+	 */
+	template<class Fn>
+	void merge(const vector<SerializationInfo>&  serializationInfos, Fn fn)
+	{
+		// we need to take care of what we have not persisted
+		vector<MerCount> inMemory = _database.sorted();
+		_database.clear();
+		_database.reserve(0);
+
+		vector<unique_ptr<RunReader<MerCount>>> runs;
+		for(const SerializationInfo& si : serializationInfos)
+			runs.push_back(unique_ptr<RunReader<MerCount>>(new RunReader<MerCount>(si)));
+
+		// min heap of the current head of every source - source runs.size() is the in memory part
+		size_t memPos = 0;
+		size_t memSource = runs.size();
+		auto head = [&](size_t source) -> const MerCount& {return source == memSource ? inMemory[memPos] : runs[source]->current();};
+		auto greater = [](const pair<Mer, size_t>& lhs, const pair<Mer, size_t>& rhs) {return rhs.first < lhs.first;};
+		std::priority_queue<pair<Mer, size_t>, vector<pair<Mer, size_t>>, decltype(greater)> heads(greater);
+		for(size_t i=0;i<runs.size();i++)
+		{
+			if(runs[i]->valid())
+				heads.push(make_pair(runs[i]->current().mer, i));
+		}
+		if(!inMemory.empty())
+			heads.push(make_pair(inMemory[0].mer, memSource));
+
+		MerCount curr;
+		bool haveCurr = false;
+		while(!heads.empty())
+		{
+			size_t source = heads.top().second;
+			heads.pop();
+			const MerCount& m = head(source);
+			_totalKmerCount += m.count;
+			if(haveCurr && curr.mer == m.mer)
+				curr.count += m.count;
+			else
+			{
+				if(haveCurr)
+					fn(curr);
+				curr = m;
+				haveCurr = true;
+			}
+
+			bool more;
+			if(source == memSource)
+				more = ++memPos < inMemory.size();
+			else
+			{
+				runs[source]->advance();
+				more = runs[source]->valid();
+			}
+			if(more)
+				heads.push(make_pair(head(source).mer, source));
+		}
+		if(haveCurr)
+			fn(curr);
+	}
+
+	unsigned long long totalKmerCount() const {return _totalKmerCount;}
+
+private:
+
+
+private:
+	size_t _n;
+	size_t _k;
+	unsigned long long _totalKmerCount;
+	HashTableConfig _hc;
+	MerMap<Mer> _database;
+};
+
+
+/*
+ * Approximate counts of one worker: a conservative update Count-Min sketch plus the kmers that might make it into the
+ * top n. A kmer is a candidate once its estimate reaches the admission threshold - whenever the candidates grow to twice
+ * the capacity only the capacity biggest are kept and the threshold rises to the smallest of them.
+ */
+template<class Mer>
+class SketchAccumulator
+{
+public:
+	using Sketch = CountMinSketch<Mer, mer_encoded_hash<Mer>>;
+	using Candidates = FlatHashMap<Mer, size_t, mer_encoded_hash<Mer>>;
+
+	SketchAccumulator(size_t width, size_t depth, size_t capacity) : _sketch(width, depth), _capacity(capacity ? capacity : 1), _threshold(1) {}
+
+	inline void add(const Mer& mer, size_t count)
+	{
+		size_t est = _sketch.add(mer, count);
+		if(est < _threshold)
+			return;
+		_candidates[mer] = est;
+		if(_candidates.size() >= 2 * _capacity)
+			prune();
+	}
+
+	const Sketch&	  sketch() const {return _sketch;}
+	const Candidates& candidates() const {return _candidates;}
+
+private:
+	void prune()
+	{
+		vector<size_t> estimates;
+		estimates.reserve(_candidates.size());
+		for(const auto& c : _candidates)
+			estimates.push_back(c.second);
+		std::nth_element(estimates.begin(), estimates.begin() + (_capacity - 1), estimates.end(), std::greater<size_t>());
+		_threshold = estimates[_capacity - 1];
+		// ties at the threshold only while there is room
+		Candidates kept;
+		size_t room = _capacity;
+		for(const auto& c : _candidates)
+		{
+			if(c.second > _threshold)
+			{
+				kept[c.first] = c.second;
+				room--;
+			}
+		}
+		for(const auto& c : _candidates)
+		{
+			if(c.second == _threshold && room)
+			{
+				kept[c.first] = c.second;
+				room--;
+			}
+		}
+		std::swap(_candidates, kept);
+	}
+
+private:
+	Sketch	   _sketch;
+	Candidates _candidates;
+	size_t	   _capacity;
+	size_t	   _threshold;
+};
+
+
+/*
+ * Result side of the approximate mode: the worker sketches are merged by addition, the candidates of all of them are
+ * estimated against the merged sketch - nothing is kept per kmer beyond the candidates and nothing goes to disk.
+ * The estimates are never below the true counts and above them by at most errorBound() with probability confidence().
+ */
+template<class Mer>
+class ApproximateResultCollector
+{
+	using MerCount = mer_count<Mer>;
+	using Result = vector<MerCount>;
+	using Accumulator = SketchAccumulator<Mer>;
+public:
+	ApproximateResultCollector(size_t n, size_t k) : _n(n), _k(k) {}
+
+	void merge(const Accumulator& acc)
+	{
+		if(!_sketch)
+			_sketch.reset(new typename Accumulator::Sketch(acc.sketch()));
+		else
+			_sketch->merge(acc.sketch());
+		for(const auto& c : acc.candidates())
+			_candidates[c.first] = 0;
+	}
+
+	/*
+	 * the candidates having one of the top n distinct estimates (ties included), biggest first
+	 */
+	Result getResult() const
+	{
+		TopNSelector<MerCount, MerCountOf> selector(_n);
+		for(const auto& c : _candidates)
+			selector.add(MerCount(c.first, estimate(c.first)));
+		return selector.result();
+	}
+
+	size_t estimate(const Mer& mer) const {return _sketch ? _sketch->estimate(mer) : 0;}
+
+	unsigned long long totalKmerCount() const {return _sketch ? _sketch->totalCount() : 0;}
+	unsigned long long errorBound() const {return _sketch ? _sketch->errorBound() : 0;}
+	double			   confidence() const {return _sketch ? _sketch->confidence() : 1.0;}
+
+private:
+	size_t _n;
+	size_t _k;
+	unique_ptr<typename Accumulator::Sketch> _sketch;
+	typename Accumulator::Candidates		 _candidates;
+};
+
+}
+
+#endif
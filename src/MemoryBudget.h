@@ -0,0 +1,84 @@
+#ifndef MEMORYBUDGET_H_
+#define MEMORYBUDGET_H_
+
+#include <atomic>
+#include <cstddef>
+#include <unistd.h>
+
+namespace kmers
+{
+
+/**
+ * The bytes the engine may hold on to, shared by everything that holds kmers or input: the parts with a fixed size
+ * (input queue, worker tables, batches in flight, filters) take theirs up front with reserve, the partitions take theirs
+ * with tryReserve whenever their table grows and spill instead once it does not fit any more. Tracked atomically, so
+ * the budget is what everybody holds right now, not a guess made up front.
+ */
+class MemoryBudget
+{
+public:
+	MemoryBudget(size_t limit) : _limit(limit ? limit : defaultLimit()), _used(0), _peak(0) {}
+
+	MemoryBudget(const MemoryBudget&) = delete;
+	MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+	size_t limit() const {return _limit;}
+	size_t used() const {return _used.load(std::memory_order_relaxed);}
+	size_t peak() const {return _peak.load(std::memory_order_relaxed);}
+	size_t available() const
+	{
+		size_t used = this->used();
+		return used < _limit ? _limit - used : 0;
+	}
+
+	/*
+	 * takes the bytes if they fit in what is left
+	 */
+	bool tryReserve(size_t bytes)
+	{
+		size_t used = _used.load(std::memory_order_relaxed);
+		do
+		{
+			if(used + bytes > _limit)
+				return false;
+		}
+		while(!_used.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+		updatePeak(used + bytes);
+		return true;
+	}
+
+	/*
+	 * takes the bytes whether they fit or not - for what has to be there to make progress at all
+	 */
+	void reserve(size_t bytes) {updatePeak(_used.fetch_add(bytes, std::memory_order_relaxed) + bytes);}
+
+	void release(size_t bytes) {_used.fetch_sub(bytes, std::memory_order_relaxed);}
+
+	/*
+	 * half of the physical memory (1 GB if it can not be told)
+	 */
+	static size_t defaultLimit()
+	{
+		long pages = sysconf(_SC_PHYS_PAGES);
+		long pageSize = sysconf(_SC_PAGE_SIZE);
+		if(pages <= 0 || pageSize <= 0)
+			return (size_t)1 << 30;
+		return (size_t)pages * (size_t)pageSize / 2;
+	}
+
+private:
+	inline void updatePeak(size_t used)
+	{
+		size_t peak = _peak.load(std::memory_order_relaxed);
+		while(used > peak && !_peak.compare_exchange_weak(peak, used, std::memory_order_relaxed));
+	}
+
+private:
+	size_t				_limit;
+	std::atomic<size_t> _used;
+	std::atomic<size_t> _peak;
+};
+
+}
+
+#endif
@@ -12,6 +12,7 @@
 #include <stdexcept>
 #include <cmath>
 #include <cstring>
+#include <BaseKernel.h>
 
 using std::string;
 
@@ -20,19 +21,12 @@ namespace kmers
 
 const char elems[] = {'a', 'c', 'g', 't', 'n'};
 
-static uint32_t getIndex(char c)
+static inline uint32_t getIndex(char c)
 {
-	if(c=='a' || c=='A')
-		return 0;
-	else if(c=='c' || c=='C')
-		return 1;
-	else if(c=='g' || c=='G')
-		return 2;
-	else if(c=='t' || c=='T')
-		return 3;
-	else if(c=='n' || c=='N')
-		return 4;
-	throw std::runtime_error("Invalid char!");
+	uint8_t code = kernel::baseCodes()[(uint8_t)c];
+	if(code == kernel::invalidCode)
+		throw std::runtime_error("Invalid char!");
+	return code;
 }
 
 static char fromIndex(char index)
@@ -54,132 +48,235 @@ static char fromIndex(char index)
 
 
 /**
- * encode the characters into this struct. Each char needs 3 bits (we have 5 possible chars) so we can have max of (64-1)/3 plus 32/3 = 31 long mers -the msf bit in the 64 bit field not used for simplicity
+ * encode the characters into this struct. Each char needs 3 bits (we have 5 possible chars) so a Word holds
+ * bits(Word)/3 chars (the msb bits not used for simplicity): char i of the kmer sits in word i/basesPerWord at bit
+ * (i%basesPerWord)*3, the first char in the lowest bits of w[0].
+ *
+ * The key width is a compile time policy - the engine picks the smallest one that fits k (see makeCountingStage):
+ *   mer32:  1 x 32 bit, k <= 10
+ *   mer64:  1 x 64 bit, k <= 21
+ *   mer128: 2 x 64 bit, k <= 42
+ *   mer256: 4 x 64 bit, k <= 84
  */
-struct mer_encoded
+template<class Word, size_t Words>
+struct mer_key
 {
-	mer_encoded() : low(0), high(0) {}
-	inline mer_encoded(const mer_encoded& other);
-	inline mer_encoded& operator=(const mer_encoded& rhs);
-	uint32_t high;
-	uint64_t low;
+	using word_type = Word;
+	static const size_t numOfWords = Words;
+	static const size_t basesPerWord = (sizeof(Word) * 8) / 3;
+	static const size_t maxK = basesPerWord * Words;
+	static const Word	wordMask = (Word)(((uint64_t)1 << (basesPerWord * 3)) - 1);
+
+	mer_key() {memset(w, 0, sizeof(w));}
+	Word w[Words];
 };
 
-mer_encoded::mer_encoded(const mer_encoded& other)
+using mer32 = mer_key<uint32_t, 1>;
+using mer64 = mer_key<uint64_t, 1>;
+using mer128 = mer_key<uint64_t, 2>;
+using mer256 = mer_key<uint64_t, 4>;
+
+template<class Word, size_t Words>
+inline bool operator==(const mer_key<Word, Words>& lhs, const mer_key<Word, Words>& rhs)
 {
-	memcpy(reinterpret_cast<char*>(&(this->low)), reinterpret_cast<const char*>(&(other.low)), sizeof(uint64_t));
-	memcpy(reinterpret_cast<char*>(&(this->high)), reinterpret_cast<const char*>(&(other.high)), sizeof(uint32_t));
+	for(size_t i=0;i<Words;i++)
+	{
+		if(lhs.w[i] != rhs.w[i])
+			return false;
+	}
+	return true;
 }
 
-mer_encoded& mer_encoded::operator=(const mer_encoded& other)
+template<class Word, size_t Words>
+inline bool operator!=(const mer_key<Word, Words>& lhs, const mer_key<Word, Words>& rhs)
 {
-	memcpy(reinterpret_cast<char*>(&low), reinterpret_cast<const char*>(&(other.low)), sizeof(uint64_t));
-	memcpy(reinterpret_cast<char*>(&high), reinterpret_cast<const char*>(&(other.high)), sizeof(uint32_t));
-	return *this;
+	return !(lhs == rhs);
 }
 
-bool operator==(const mer_encoded& lhs, const mer_encoded& rhs)
+/*
+ * total order of the encodings (most significant word first) - the order of the sorted spill runs
+ */
+template<class Word, size_t Words>
+inline bool operator<(const mer_key<Word, Words>& lhs, const mer_key<Word, Words>& rhs)
 {
-	if( !memcmp(&(lhs.low), &(rhs.low), sizeof(uint64_t)) && !memcmp(&(lhs.high), &(rhs.high), sizeof(uint32_t)) )
-		return true;
-	else
-		return false;
+	for(size_t i=Words;i-->0;)
+	{
+		if(lhs.w[i] != rhs.w[i])
+			return lhs.w[i] < rhs.w[i];
+	}
+	return false;
 }
 
 
-// TODO revise this!
+/**
+ * the tables are open addressed with power of two sizes (FlatHashMap) - every bit of the encoding has to be
+ * mixed into the hash
+ */
+template<class Mer>
 class mer_encoded_hash
 {
 public:
-	size_t operator()(const mer_encoded& mer) const
+	size_t operator()(const Mer& mer) const
 	{
-		/*
-		uint64_t l = integerHash(mer.low);
-		uint32_t h = integerHash(mer.high);
-		return l * (uint64_t)h;
-		*/
-		return (unsigned int)((size_t)(mer.low) + (size_t)(mer.high));
+		uint64_t h = integerHash((uint64_t)mer.w[Mer::numOfWords-1]);
+		for(size_t i=Mer::numOfWords-1;i-->0;)
+			h = integerHash((uint64_t)mer.w[i] ^ h);
+		return (size_t)h;
 	}
 private:
-	inline uint32_t integerHash(uint32_t h) const
-	{
-	    h ^= h >> 16;
-	    h *= 0x85ebca6b;
-	    h ^= h >> 13;
-	    h *= 0xc2b2ae35;
-	    h ^= h >> 16;
-	    return h;
-	}
-
 	inline uint64_t integerHash(uint64_t h) const
 	{
-		h ^= h >> 32;
-		h *= 0x85ebca6b85ebca6b;
-		h ^= h >> 26;
-		h *= 0xc2b2ae35c2b2ae35;
-		h ^= h >> 32;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccd;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53;
+		h ^= h >> 33;
 		return h;
 	}
 
 };
-mer_encoded encode(const char* s, size_t k)
+
+/*
+ * which of the numOfPartitions hash partitions the kmer belongs to
+ */
+template<class Mer>
+inline size_t partitionOf(const Mer& mer, size_t numOfPartitions)
+{
+	return mer_encoded_hash<Mer>()(mer) % numOfPartitions;
+}
+
+template<class Mer>
+Mer encode(const char* s, size_t k)
 {
-	mer_encoded enc;
-	memset(&enc, 0, sizeof(enc));
-	uint64_t& v = enc.low;
-	v = 0;
-	int i = 0;
-	uint64_t index = 0;
-	for( ;i<k && i<21;i++)
+	using Word = typename Mer::word_type;
+	Mer enc;
+	for(size_t i=0;i<k;i++)
 	{
-		index =  getIndex(*s++);
-		v |= (index << (i*3));
+		Word index = getIndex(*s++);
+		enc.w[i / Mer::basesPerWord] |= (index << ((i % Mer::basesPerWord) * 3));
 	}
-	if(i!=k)
+	return enc;
+}
+
+/*
+ * index of the complementary base: a<->t, c<->g, n stays n
+ */
+inline uint64_t complementIndex(uint64_t index)
+{
+	static const uint64_t comp[] = {3, 2, 1, 0, 4};
+	return comp[index];
+}
+
+/**
+ * Keeps the encoding of a sliding window of k chars up to date in O(1) per char instead of re-encoding
+ * the whole window with encode(). The layout is the same as encode(): the oldest char sits in the lowest 3 bits
+ * of w[0], so rolling shifts everything down by one char (the lowest char of every word moves into the top slot of the
+ * word below) and puts the new char into the slot of position k-1.
+ *
+ * canonical: the reverse complement of the window is rolled along (shifting up, the complement of the new char enters
+ * at position 0) and mer() is the smaller of the two encodings - a kmer and its reverse complement give the same mer()
+ */
+template<class Mer>
+class RollingEncoder
+{
+	using Word = typename Mer::word_type;
+	static const size_t Words = Mer::numOfWords;
+	static const size_t topSlotShift = (Mer::basesPerWord - 1) * 3;
+public:
+	RollingEncoder(size_t k, bool canonical = false) : _k(k),
+													   _filled(0),
+													   _lastWord((k-1) / Mer::basesPerWord),
+													   _lastShift(((k-1) % Mer::basesPerWord) * 3),
+													   _canonical(canonical),
+													   _rcSmaller(false)
 	{
-		uint32_t& h = enc.high;
-		h = 0;
-		int j=0;
-		for( ;i<k;i++)
+		if(k == 0 || k > Mer::maxK)
+			throw std::runtime_error("Kmer length does not fit the key width!");
+		// the words (parts of them) above position k-1 are always kept zero in the reverse complement
+		for(size_t i=0;i<Words;i++)
 		{
-			index = getIndex(*s++);
-			h |= (index << (j*3));
-			j++;
+			if(i < _lastWord)
+				_masks[i] = Mer::wordMask;
+			else if(i == _lastWord)
+				_masks[i] = (Word)((((uint64_t)1 << (_lastShift + 3)) - 1));
+			else
+				_masks[i] = 0;
 		}
 	}
 
-	return enc;
-}
-
-string decode(const mer_encoded& enc, size_t k)
-{
-	string s(k, 0);
-	uint64_t v  = enc.low;
-	int  i = 0;
-	char index = 0;
-	char c = 0;
-	for( ;i<k && i<21;i++)
+	/*
+	 * pushes the next char into the window - returns true once the window holds k chars (mer() is a valid kmer)
+	 */
+	inline bool roll(char c)
 	{
-		index = ((uint64_t)0x7 & (v >> (i*3)));
-		c =  fromIndex(index);
-		s[i] = c;
+		return rollIndex(getIndex(c));
 	}
-	if(i!=k)
+
+	inline bool rollIndex(Word index)
 	{
-		uint32_t h = enc.high;
-		int j=0;
-		for( ;i<k;i++)
+		for(size_t i=0;i+1<Words;i++)
+			_mer.w[i] = (_mer.w[i] >> 3) | ((_mer.w[i+1] & 0x7) << topSlotShift);
+		_mer.w[Words-1] >>= 3;
+		_mer.w[_lastWord] |= (index << _lastShift);
+		if(_canonical)
 		{
-			index = ((uint64_t)0x7 & (h >> (j*3)));
-			c = fromIndex(index);
-			s[i] = c;
-			j++;
+			for(size_t i=Words-1;i>0;i--)
+				_rc.w[i] = (((_rc.w[i] << 3) | (_rc.w[i-1] >> topSlotShift)) & _masks[i]);
+			_rc.w[0] = ((_rc.w[0] << 3) & _masks[0]) | (Word)complementIndex(index);
+			_rcSmaller = _rc < _mer;
 		}
+		if(_filled < _k)
+			++_filled;
+		return _filled == _k;
+	}
+
+	inline const Mer& mer() const {return _rcSmaller ? _rc : _mer;}
+
+	void reset()
+	{
+		_mer = Mer();
+		_rc = Mer();
+		_rcSmaller = false;
+		_filled = 0;
 	}
 
+private:
+	size_t		_k;
+	size_t		_filled;
+	size_t		_lastWord;
+	uint32_t	_lastShift;
+	bool		_canonical;
+	bool		_rcSmaller;
+	Word		_masks[Words];
+	Mer			_mer;
+	Mer			_rc;
+};
+
+template<class Mer>
+string decode(const Mer& enc, size_t k)
+{
+	string s(k, 0);
+	for(size_t i=0;i<k;i++)
+	{
+		char index = (char)(0x7 & (enc.w[i / Mer::basesPerWord] >> ((i % Mer::basesPerWord) * 3)));
+		s[i] = fromIndex(index);
+	}
 	return s;
 }
 
+/*
+ * the encoding a canonical RollingEncoder would give for the kmer: the smaller of it and its reverse complement
+ */
+template<class Mer>
+Mer canonical(const Mer& enc, size_t k)
+{
+	string s = decode(enc, k);
+	RollingEncoder<Mer> roller(k, true);
+	for(auto it = s.begin(); it != s.end(); ++it)
+		roller.roll(*it);
+	return roller.mer();
+}
+
 }
 
 
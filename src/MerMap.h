@@ -10,13 +10,13 @@
 
 #include <Mer.h>
 #include <Serializer.h>
-#include <unordered_map>
-#include <unordered_set>
+#include <FlatHashMap.h>
+#include <TopN.h>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <cassert>
 
-using std::unordered_set;
 using std::vector;
 
 using std::cout;
@@ -25,21 +25,37 @@ using serialization::Encoded;
 
 namespace kmers
 {
-using std::unordered_map;
 
 
+/*
+ * the record of the spill runs and of the batches sent to the partitions - Mer is one of the key widths of Mer.h
+ */
+template<class Mer>
 struct mer_count
 {
 	mer_count() : count(0){}
-	mer_count(const mer_encoded& m, size_t c) : mer(m), count(c) {}
-	mer_encoded mer;
+	mer_count(const Mer& m, size_t c) : mer(m), count(c) {}
+	Mer			mer;
 	size_t	    count;
 };
 
+struct MerCountOf
+{
+	template<class Mer>
+	size_t operator()(const mer_count<Mer>& m) const {return m.count;}
+};
+
+struct MerOrder
+{
+	template<class Mer>
+	bool operator()(const mer_count<Mer>& lhs, const mer_count<Mer>& rhs) const {return lhs.mer < rhs.mer;}
+};
+
 struct merstring_count
 {
 	merstring_count() : count(0){}
-	merstring_count(const mer_encoded& m, size_t c, size_t k) : count(c)
+	template<class Mer>
+	merstring_count(const Mer& m, size_t c, size_t k) : count(c)
 	{
 		mer = decode(m, k);
 	}
@@ -49,21 +65,27 @@ struct merstring_count
 };
 
 
+template<class Mer>
 class MerMap : public Serializable
 {
-	using HashMap = unordered_map<mer_encoded, size_t, mer_encoded_hash>;
+	using HashMap = FlatHashMap<Mer, size_t, mer_encoded_hash<Mer>>;
+	using MerCount = mer_count<Mer>;
 public:
-	using const_iterator = HashMap::const_iterator;
+	using const_iterator = typename HashMap::const_iterator;
 	MerMap(size_t k) : _k(k){}
 	~MerMap() {}
 
-	// unordered_map interface
+	// hash map interface
 	inline void reserve(size_t s) {_map.reserve(s);}
-	inline HashMap::const_iterator begin() const {return _map.begin();}
-	inline HashMap::const_iterator end() const {return _map.end();}
+	inline void max_load_factor(float f) {_map.max_load_factor(f);}
+	inline size_t memoryUsage() const {return _map.memoryUsage();}
+	inline size_t capacity() const {return _map.capacity();}
+	inline size_t memoryFor(size_t n) const {return _map.memoryFor(n);}
+	inline const_iterator begin() const {return _map.begin();}
+	inline const_iterator end() const {return _map.end();}
 	inline void					   clear() {_map.clear();_map.reserve(0);_merCountList.clear();_merCountList.reserve(0);}
 	inline size_t				   size() {return _map.size();}
-	size_t& operator[](const mer_encoded& key)
+	size_t& operator[](const Mer& key)
 	{
 		return _map[key];
 	}
@@ -72,24 +94,26 @@ public:
 	Encoded serialize() const
 	{
 		int i = 0;
-		mer_count* buff = new mer_count[_map.size()];
-		for(HashMap::const_iterator it = _map.begin(); it!=_map.end();it++)
+		MerCount* buff = new MerCount[_map.size()];
+		for(const_iterator it = _map.begin(); it!=_map.end();it++)
 		{
-			const mer_encoded& mer = it->first;
-			size_t			   count = it->second;
-			buff[i++] = mer_count(mer, count);
+			const Mer& mer = it->first;
+			size_t	   count = it->second;
+			buff[i++] = MerCount(mer, count);
 		}
-		Encoded encoded((char*)buff, sizeof(mer_count)*_map.size());
+		// spills are written as runs sorted by the encoding so they can be merged in one streaming pass
+		std::sort(buff, buff + _map.size(), MerOrder());
+		Encoded encoded((char*)buff, sizeof(MerCount)*_map.size());
 		return encoded;
 	}
 
 
 	void deserialize(const Encoded& enc)
 	{
-		mer_count* mers = (mer_count*)(enc.getBuffer());
+		MerCount* mers = (MerCount*)(enc.getBuffer());
 		size_t bytes = enc.getSize();
-		size_t count = bytes / sizeof(mer_count);
-		assert((bytes % sizeof(mer_count)) == 0);
+		size_t count = bytes / sizeof(MerCount);
+		assert((bytes % sizeof(MerCount)) == 0);
 
 		for(int i=0;i<count;i++)
 		{
@@ -117,7 +141,7 @@ public:
 		}
 		else
 		{
-			for(MerMap::const_iterator it=_map.begin();it!=_map.end();it++)
+			for(const_iterator it=_map.begin();it!=_map.end();it++)
 			{
 				tc+=it->second;
 			}
@@ -127,77 +151,37 @@ public:
 	}
 
 	/*
-	 * brute force extraction of the top n size elements
+	 * the content of the table ordered by the encoding - same order as the serialized runs
 	 */
-	vector<mer_count> extract(size_t n)
+	vector<MerCount> sorted() const
 	{
-		vector<mer_count>* from = nullptr;
-		if(_deserialized)
-			from = &_merCountList;
-		else
-		{
-			from = new vector<mer_count>();
-			for(const auto& p : _map)
-			{
-				from->push_back(mer_count(p.first, p.second));
-			}
-		}
-
-		vector<mer_count> res;
-		int count = 0;
-		size_t limitSize = std::numeric_limits<size_t>::max();
-		while(count < n)
-		{
-			size_t biggest = 0;
-			for(const auto& p : *from)
-			{
-				if(p.count > biggest && p.count < limitSize)
-					biggest = p.count;
-			}
-			count++;
-			limitSize = biggest;
-			// second pass -> populate the res array with the biggest sizes
-			for(const auto& p : *from)
-			{
-				if(p.count == biggest)
-				{
-					res.push_back(p);
-				}
-			}
-		}
-
+		vector<MerCount> res;
+		res.reserve(_map.size());
+		for(const auto& p : _map)
+			res.push_back(MerCount(p.first, p.second));
+		std::sort(res.begin(), res.end(), MerOrder());
 		return res;
-
 	}
 
-	vector<mer_count> extract(unordered_set<mer_encoded, mer_encoded_hash> mers)
+	/*
+	 * the elements having one of the top n distinct counts (ties included), biggest count first
+	 */
+	vector<MerCount> extract(size_t n) const
 	{
-		vector<mer_count>* from = nullptr;
+		TopNSelector<MerCount, MerCountOf> selector(n);
 		if(_deserialized)
-			from = &_merCountList;
+			selector.add(_merCountList.begin(), _merCountList.end());
 		else
 		{
-			from = new vector<mer_count>();
 			for(const auto& p : _map)
-			{
-				from->push_back(mer_count(p.first, p.second));
-			}
-		}
-
-		vector<mer_count> res;
-		for(const auto& p : *from)
-		{
-			if(mers.find(p.mer)!=mers.end())
-				res.push_back(p);
+				selector.add(MerCount(p.first, p.second));
 		}
-
-		return res;
+		return selector.result();
 	}
 
-
 private:
 	HashMap _map;
-	vector<mer_count> _merCountList;
+	vector<MerCount> _merCountList;
 	bool _deserialized = false;
 	size_t _k;
 };
@@ -0,0 +1,292 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <StopWatch.h>
+#include <MemoryBudget.h>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cstdint>
+#include <ctime>
+
+namespace kmers
+{
+
+using std::atomic;
+using std::string;
+using std::vector;
+
+inline uint64_t cpuNanos(clockid_t clock)
+{
+	timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * the time (wall and cpu of the threads doing it) and the work of one stage of the pipeline, summed over every thread
+ * and call - updated once per block or batch, never per kmer
+ */
+struct StageMetrics
+{
+	StageMetrics() : wallNanos(0), cpuNanos(0), calls(0), bytes(0), kmers(0) {}
+
+	void add(uint64_t wall, uint64_t cpu, uint64_t bytes_, uint64_t kmers_)
+	{
+		wallNanos.fetch_add(wall, std::memory_order_relaxed);
+		cpuNanos.fetch_add(cpu, std::memory_order_relaxed);
+		calls.fetch_add(1, std::memory_order_relaxed);
+		bytes.fetch_add(bytes_, std::memory_order_relaxed);
+		kmers.fetch_add(kmers_, std::memory_order_relaxed);
+	}
+
+	atomic<uint64_t> wallNanos;
+	atomic<uint64_t> cpuNanos;
+	atomic<uint64_t> calls;
+	atomic<uint64_t> bytes;
+	atomic<uint64_t> kmers;
+};
+
+/*
+ * times the scope into a stage (nothing if the stage is null) - the wall time by StopWatch, the cpu time of the thread
+ */
+class StageTimer
+{
+public:
+	StageTimer(StageMetrics* stage) : _stage(stage), _cpu(0), _bytes(0), _kmers(0)
+	{
+		if(!_stage)
+			return;
+		_watch.start();
+		_cpu = cpuNanos(CLOCK_THREAD_CPUTIME_ID);
+	}
+
+	~StageTimer()
+	{
+		if(_stage)
+			_stage->add(_watch.stop(), cpuNanos(CLOCK_THREAD_CPUTIME_ID) - _cpu, _bytes, _kmers);
+	}
+
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+	void bytes(uint64_t bytes) {_bytes += bytes;}
+	void kmers(uint64_t kmers) {_kmers += kmers;}
+
+private:
+	StageMetrics*					_stage;
+	StopWatch<std::chrono::nanoseconds> _watch;
+	uint64_t						_cpu;
+	uint64_t						_bytes;
+	uint64_t						_kmers;
+};
+
+/*
+ * depth of a queue sampled every time something is put into it
+ */
+struct QueueMetrics
+{
+	QueueMetrics() : samples(0), total(0), max(0) {}
+
+	void sample(size_t depth)
+	{
+		samples.fetch_add(1, std::memory_order_relaxed);
+		total.fetch_add(depth, std::memory_order_relaxed);
+		uint64_t seen = max.load(std::memory_order_relaxed);
+		while(depth > seen && !max.compare_exchange_weak(seen, depth, std::memory_order_relaxed));
+	}
+
+	atomic<uint64_t> samples;
+	atomic<uint64_t> total;
+	atomic<uint64_t> max;
+};
+
+/**
+ * What a run spent its time on, for telling an I/O bound run from one stuck merging or spilling: the stages of the
+ * pipeline (reader thread, parsing, the counting of every worker, the partition merges and spills, the final
+ * collection), the depths of the queues between them, the load of the tables once counted and the memory budget.
+ * Everything is summed up with relaxed atomics as it goes, json() is a snapshot that can be taken at any time -
+ * startReporting prints one every interval while the run goes on.
+ */
+class Metrics
+{
+public:
+	Metrics(size_t numOfWorkers, const MemoryBudget* budget = nullptr) : _budget(budget),
+																		 _workers(numOfWorkers ? numOfWorkers : 1),
+																		 _start(std::chrono::steady_clock::now()),
+																		 _cpuStart(cpuNanos(CLOCK_PROCESS_CPUTIME_ID)),
+																		 _stopReporting(false)
+	{
+	}
+
+	~Metrics() {stopReporting();}
+
+	Metrics(const Metrics&) = delete;
+	Metrics& operator=(const Metrics&) = delete;
+
+	StageMetrics& worker(size_t i) {return _workers[i];}
+
+	/*
+	 * a table once it is filled (at most one record per name)
+	 */
+	void table(const string& name, size_t size, size_t capacity)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for(Table& t : _tables)
+		{
+			if(t.name == name)
+			{
+				t.size = size;
+				t.capacity = capacity;
+				return;
+			}
+		}
+		_tables.push_back(Table{name, size, capacity});
+	}
+
+	string json()
+	{
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+		std::ostringstream out;
+		out << "{\"elapsed_seconds\":" << elapsed
+			<< ",\"cpu_seconds\":" << (cpuNanos(CLOCK_PROCESS_CPUTIME_ID) - _cpuStart) / 1e9
+			<< ",\"stages\":{";
+		const char* names[] = {"read", "read_wait", "parse", "count", "finish", "merge", "spill", "recount", "collect"};
+		StageMetrics* stages[] = {&read, &readWait, &parse, nullptr, &finish, &merge, &spill, &recount, &collect};
+		// the counting is the sum of the workers
+		StageMetrics counted;
+		uint64_t calls = 0;
+		for(const StageMetrics& w : _workers)
+		{
+			counted.add(w.wallNanos, w.cpuNanos, w.bytes, w.kmers);
+			calls += w.calls;
+		}
+		counted.calls = calls;
+		for(size_t i=0;i<sizeof(names)/sizeof(names[0]);i++)
+		{
+			out << (i ? "," : "") << "\"" << names[i] << "\":";
+			writeStage(out, stages[i] ? *stages[i] : counted);
+		}
+		out << "},\"workers\":[";
+		for(size_t i=0;i<_workers.size();i++)
+		{
+			out << (i ? "," : "");
+			writeStage(out, _workers[i]);
+		}
+		out << "],\"queues\":{\"input\":";
+		writeQueue(out, inputQueue);
+		out << ",\"work\":";
+		writeQueue(out, workQueue);
+		out << ",\"partition\":";
+		writeQueue(out, partitionQueue);
+		out << "},\"tables\":[";
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			for(size_t i=0;i<_tables.size();i++)
+			{
+				const Table& t = _tables[i];
+				out << (i ? "," : "") << "{\"name\":\"" << t.name << "\",\"size\":" << t.size << ",\"capacity\":" << t.capacity
+					<< ",\"load_factor\":" << (t.capacity ? (double)t.size / t.capacity : 0.0) << "}";
+			}
+		}
+		out << "]";
+		if(_budget)
+			out << ",\"memory\":{\"limit_bytes\":" << _budget->limit() << ",\"used_bytes\":" << _budget->used()
+				<< ",\"peak_bytes\":" << _budget->peak() << "}";
+		out << "}";
+		return out.str();
+	}
+
+	void write(const string& path)
+	{
+		std::ofstream out(path.c_str());
+		out << json() << "\n";
+		if(!out)
+			throw std::runtime_error("Could not write the metrics to " + path);
+	}
+
+	/*
+	 * a snapshot on one line of out every intervalSeconds until stopReporting
+	 */
+	void startReporting(double intervalSeconds, std::ostream& out)
+	{
+		if(intervalSeconds <= 0 || _reporter.joinable())
+			return;
+		_reporter = std::thread([this, intervalSeconds, &out]()
+								{
+									std::unique_lock<std::mutex> lock(_reportMutex);
+									auto interval = std::chrono::duration<double>(intervalSeconds);
+									while(!_condvarStop.wait_for(lock, interval, [this]() {return _stopReporting;}))
+										out << json() << std::endl;
+								});
+	}
+
+	void stopReporting()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_reportMutex);
+			_stopReporting = true;
+			_condvarStop.notify_all();
+		}
+		if(_reporter.joinable())
+			_reporter.join();
+	}
+
+	StageMetrics read;		// the reads and the decompression of the input (on the reader thread or the pool)
+	StageMetrics readWait;	// the reader waiting for a free buffer - the consumer is behind
+	StageMetrics parse;		// cutting the blocks into records
+	StageMetrics finish;	// flushing the workers and waiting for the partitions once the input is done
+	StageMetrics merge;		// the partitions merging the batches of the workers (spills included)
+	StageMetrics spill;		// writing the runs of the partitions
+	StageMetrics recount;	// the second pass
+	StageMetrics collect;	// merging the runs and picking the results
+	QueueMetrics inputQueue;	// blocks read but not parsed yet
+	QueueMetrics workQueue;		// blocks waiting for a worker
+	QueueMetrics partitionQueue;	// batches waiting for a partition
+
+private:
+	struct Table
+	{
+		string name;
+		size_t size;
+		size_t capacity;
+	};
+
+	static void writeStage(std::ostream& out, const StageMetrics& s)
+	{
+		double wall = s.wallNanos / 1e9;
+		out << "{\"wall_seconds\":" << wall << ",\"cpu_seconds\":" << s.cpuNanos / 1e9 << ",\"calls\":" << s.calls
+			<< ",\"bytes\":" << s.bytes << ",\"kmers\":" << s.kmers
+			<< ",\"mb_per_second\":" << (wall > 0 ? s.bytes / wall / (1 << 20) : 0.0)
+			<< ",\"kmers_per_second\":" << (wall > 0 ? s.kmers / wall : 0.0) << "}";
+	}
+
+	static void writeQueue(std::ostream& out, const QueueMetrics& q)
+	{
+		out << "{\"samples\":" << q.samples << ",\"mean_depth\":" << (q.samples ? (double)q.total / q.samples : 0.0)
+			<< ",\"max_depth\":" << q.max << "}";
+	}
+
+private:
+	const MemoryBudget*	 _budget;
+	vector<StageMetrics> _workers;
+	std::chrono::steady_clock::time_point _start;
+	uint64_t			 _cpuStart;
+	std::mutex			 _mutex;
+	vector<Table>		 _tables;
+	std::mutex			 _reportMutex;
+	std::condition_variable _condvarStop;
+	bool				 _stopReporting;
+	std::thread			 _reporter;
+};
+
+}
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef PARTITIONAGGREGATOR_H_
+#define PARTITIONAGGREGATOR_H_
+
+#include <KmerResultCollector.h>
+#include <MerMap.h>
+#include <FileSerializer.h>
+#include <MemoryBudget.h>
+#include <Metrics.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <string>
+#include <cstdio>
+
+using serialization::FileSerializer;
+using serialization::SerializationInfo;
+
+namespace kmers
+{
+
+using std::thread;
+using std::mutex;
+using std::unique_lock;
+using std::lock_guard;
+using std::condition_variable;
+using std::deque;
+using std::vector;
+
+template<class Mer>
+using MerBatch = vector<mer_count<Mer>>;
+
+/**
+ * Owns one hash partition of the kmer space (see partitionOf): its own database, spill files and aggregator thread.
+ * The workers push batches of (kmer, count) pairs belonging to this partition, the aggregator thread merges them into
+ * the database and spills it once its next growth does not fit in the memory budget any more. Partitions never share a
+ * kmer so they all merge in parallel and the top n can be computed per partition.
+ */
+template<class Mer>
+class PartitionAggregator
+{
+	using Batch = MerBatch<Mer>;
+	using MerCount = mer_count<Mer>;
+public:
+	PartitionAggregator(size_t id, size_t n, size_t k, const HashTableConfig& hc, MemoryBudget& budget, size_t maxPendingBatches,
+						Metrics* metrics = nullptr, const std::string& spillPrefix = "map") :
+																				_id(id),
+																				_k(k),
+																				_spillPrefix(spillPrefix),
+																				_budget(budget),
+																				_metrics(metrics),
+																				_reserved(0),
+																				_maxPendingBatches(maxPendingBatches ? maxPendingBatches : 1),
+																				_finished(false),
+																				_resultCollector(n, k, hc)
+	{
+		_reserved = _resultCollector.GlobalDataBase().memoryUsage();
+		_budget.reserve(_reserved);
+	}
+
+	~PartitionAggregator()
+	{
+		finish();
+		// the runs are left over when the counting failed before the collect
+		deleteSerializedFiles();
+		_budget.release(_reserved);
+	}
+
+	PartitionAggregator(const PartitionAggregator&) = delete;
+	PartitionAggregator& operator=(const PartitionAggregator&) = delete;
+
+	void start()
+	{
+		_thread = thread(&PartitionAggregator::run, this);
+	}
+
+	/*
+	 * called by the workers - blocks while the aggregator is behind by maxPendingBatches batches
+	 */
+	void push(Batch&& batch)
+	{
+		if(batch.empty())
+			return;
+		unique_lock<mutex> lock(_mutex);
+		while(_pending.size() >= _maxPendingBatches)
+			_condvarSpace.wait(lock);
+		_pending.push_back(std::move(batch));
+		if(_metrics)
+			_metrics->partitionQueue.sample(_pending.size());
+		_condvarPending.notify_one();
+	}
+
+	/*
+	 * no more batches are coming - returns once everything pushed so far is merged
+	 */
+	void finish()
+	{
+		{
+			lock_guard<mutex> lock(_mutex);
+			_finished = true;
+			_condvarPending.notify_one();
+		}
+		if(_thread.joinable())
+			_thread.join();
+	}
+
+	/*
+	 * exact top n of this partition - call after finish (once, it drains the partition)
+	 */
+	vector<MerCount> getResult()
+	{
+		return getResult(_resultCollector.n());
+	}
+
+	vector<MerCount> getResult(size_t n)
+	{
+		return getResult(n, [](const MerCount&) {});
+	}
+
+	/*
+	 * same while every distinct kmer of the partition goes to fn as well (in ascending order)
+	 */
+	template<class Fn>
+	vector<MerCount> getResult(size_t n, Fn fn)
+	{
+		vector<MerCount> result = _resultCollector.getResult(_serializationInfos, n, fn);
+		// the database is drained by now
+		_budget.release(_reserved);
+		_reserved = 0;
+		return result;
+	}
+
+	unsigned long long totalKmerCount() const {return _resultCollector.totalKmerCount();}
+
+	// the in memory table - after finish
+	size_t tableSize() {return _resultCollector.GlobalDataBase().size();}
+	size_t tableCapacity() {return _resultCollector.GlobalDataBase().capacity();}
+
+	/*
+	 * upper bound of the distinct kmers of the partition (a kmer can be in more than one spilled run) - after finish
+	 */
+	size_t estimatedKmers()
+	{
+		size_t estimate = _resultCollector.GlobalDataBase().size();
+		for(const auto& si : _serializationInfos)
+			estimate += si.byteCount / sizeof(MerCount);
+		return estimate;
+	}
+
+	void deleteSerializedFiles()
+	{
+		for(const auto& si : _serializationInfos)
+		{
+			std::remove(si.filename.c_str());
+		}
+		_serializationInfos.clear();
+	}
+
+private:
+	void run()
+	{
+		Batch batch;
+		while(true)
+		{
+			{
+				unique_lock<mutex> lock(_mutex);
+				while(_pending.empty() && !_finished)
+					_condvarPending.wait(lock);
+				if(_pending.empty())
+					return;
+				batch = std::move(_pending.front());
+				_pending.pop_front();
+				_condvarSpace.notify_all();
+			}
+			merge(batch);
+			batch.clear();
+		}
+	}
+
+	/*
+	 * grows the database up front for the whole batch (at most that many new kmers) - while it rehashes the old and the
+	 * new table are both there, that much has to fit in the budget or the database is spilled first. An empty database
+	 * takes the batch whatever the budget says, there is nothing to spill
+	 */
+	void merge(const Batch& batch)
+	{
+		StageTimer timer(_metrics ? &_metrics->merge : nullptr);
+		timer.bytes(batch.size() * sizeof(MerCount));
+		timer.kmers(batch.size());
+		MerMap<Mer>& database = _resultCollector.GlobalDataBase();
+		size_t needed = database.memoryFor(database.size() + batch.size());
+		if(needed > _reserved)
+		{
+			if(!_budget.tryReserve(needed))
+			{
+				if(database.size())
+				{
+					spill(database);
+					needed = database.memoryFor(batch.size());
+				}
+				_budget.reserve(needed);
+			}
+			database.reserve(database.size() + batch.size());
+			_budget.release(_reserved);
+			_reserved = needed;
+		}
+
+		for(const MerCount& m : batch)
+			database[m.mer] += m.count;
+	}
+
+	void spill(MerMap<Mer>& database)
+	{
+		// the sorted run is built next to the table
+		size_t runBytes = database.size() * sizeof(MerCount);
+		StageTimer timer(_metrics ? &_metrics->spill : nullptr);
+		timer.bytes(runBytes);
+		timer.kmers(database.size());
+		_budget.reserve(runBytes);
+
+		// k in the name: the partitions of several k spill side by side
+		char buff[512] = {0};
+		snprintf(buff, sizeof(buff), "%s_%lu_%lu_%lu", _spillPrefix.c_str(), _k, _id, _serializationInfos.size());
+		SerializationInfo si = FileSerializer::write(database, buff);
+		_serializationInfos.push_back(si);
+
+		database.clear();
+		_budget.release(runBytes + _reserved);
+		_reserved = 0;
+	}
+
+private:
+	size_t				_id;
+	size_t				_k;
+	std::string			_spillPrefix;
+	MemoryBudget&		_budget;
+	Metrics*			_metrics;
+	size_t				_reserved;		// bytes of the budget the database holds
+	size_t				_maxPendingBatches;
+	bool				_finished;
+	mutex				_mutex;
+	condition_variable	_condvarPending;
+	condition_variable	_condvarSpace;
+	deque<Batch>			_pending;
+	thread				_thread;
+	KmerResultCollector<Mer> _resultCollector;
+	vector<SerializationInfo> _serializationInfos;
+};
+
+}
+
+#endif
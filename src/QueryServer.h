@@ -0,0 +1,241 @@
+#ifndef QUERYSERVER_H_
+#define QUERYSERVER_H_
+
+#include <KmerDatabase.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace kmers
+{
+
+using std::string;
+using std::vector;
+using std::thread;
+
+/*
+ * the answer to a batch of request lines: one count per line in the order of the lines, -1 for a line that is not a kmer
+ * of the database's k (a trailing '\r' is ignored)
+ */
+inline void answerLines(const KmerDatabase& database, vector<string>& lines, string& out)
+{
+	const uint8_t* codes = kernel::baseCodes();
+	vector<string> kmers;
+	vector<size_t> positions;
+	kmers.reserve(lines.size());
+	for(size_t i=0;i<lines.size();i++)
+	{
+		string& line = lines[i];
+		if(!line.empty() && line[line.size()-1] == '\r')
+			line.erase(line.size()-1);
+		bool valid = line.size() == database.k();
+		for(size_t j=0;j<line.size() && valid;j++)
+			valid = codes[(uint8_t)line[j]] != kernel::invalidCode;
+		if(valid)
+		{
+			kmers.push_back(string());
+			kmers.back().swap(line);
+			positions.push_back(i);
+		}
+	}
+	vector<uint64_t> counts;
+	database.count(kmers, counts);
+
+	size_t next = 0;
+	char buff[32];
+	for(size_t i=0;i<lines.size();i++)
+	{
+		if(next < positions.size() && positions[next] == i)
+			out.append(buff, snprintf(buff, sizeof(buff), "%llu\n", (unsigned long long)counts[next++]));
+		else
+			out.append("-1\n");
+	}
+}
+
+/*
+ * moves the complete lines of pending to lines - the unfinished last one stays
+ */
+inline void splitLines(string& pending, vector<string>& lines)
+{
+	size_t start = 0;
+	size_t nl;
+	while((nl = pending.find('\n', start)) != string::npos)
+	{
+		lines.push_back(pending.substr(start, nl - start));
+		start = nl + 1;
+	}
+	pending.erase(0, start);
+}
+
+/**
+ * Local query service over a loaded database: clients connect to a Unix socket, write kmers one per line and read back
+ * one count per line in the same order (see answerLines). The lines are answered as a batch every time some arrive, so
+ * a client can stream any number of them and read the answers as it goes - the connection is over when the client shuts
+ * down its side. Every client gets a thread of its own, the database is shared read only.
+ */
+class QueryServer
+{
+public:
+	QueryServer(const KmerDatabase& database, const string& socketPath) : _database(database),
+																		  _socketPath(socketPath),
+																		  _fd(-1),
+																		  _stopped(false)
+	{
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if(socketPath.size() >= sizeof(addr.sun_path))
+			throw std::runtime_error("Socket path too long: " + socketPath);
+		strcpy(addr.sun_path, socketPath.c_str());
+		// a socket left behind by a previous run
+		unlink(socketPath.c_str());
+		_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(_fd < 0 || bind(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(_fd, _backlog) != 0)
+		{
+			if(_fd >= 0)
+				close(_fd);
+			throw std::runtime_error("Could not listen on " + socketPath);
+		}
+	}
+
+	~QueryServer()
+	{
+		stop();
+		for(Client& c : _clients)
+			c.handle.join();
+		unlink(_socketPath.c_str());
+	}
+
+	QueryServer(const QueryServer&) = delete;
+	QueryServer& operator=(const QueryServer&) = delete;
+
+	/*
+	 * serves the clients until stop is called
+	 */
+	void run()
+	{
+		while(!_stopped)
+		{
+			int client = accept(_fd, nullptr, nullptr);
+			if(client < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				break;
+			}
+			reap();
+			_clients.emplace_back();
+			Client& c = _clients.back();
+			c.handle = thread([this, client, &c]()
+							  {
+								serve(client);
+								c.done = true;
+							  });
+		}
+	}
+
+	void stop()
+	{
+		if(_stopped.exchange(true))
+			return;
+		shutdown(_fd, SHUT_RDWR);
+		close(_fd);
+	}
+
+private:
+	/*
+	 * a connection and whether its thread is through with it
+	 */
+	struct Client
+	{
+		Client() : done(false) {}
+		thread			  handle;
+		std::atomic<bool> done;
+	};
+
+	/*
+	 * joins the threads of the clients gone since the last accept - a long running server only keeps the ones connected
+	 */
+	void reap()
+	{
+		for(auto it = _clients.begin(); it != _clients.end(); )
+		{
+			if(it->done)
+			{
+				it->handle.join();
+				it = _clients.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+
+	void serve(int client)
+	{
+		char buff[1 << 16];
+		string pending;
+		vector<string> lines;
+		string out;
+		ssize_t len;
+		bool replying = true;
+		while((len = read(client, buff, sizeof(buff))) > 0 || (len < 0 && errno == EINTR))
+		{
+			if(len < 0)
+				continue;
+			pending.append(buff, len);
+			splitLines(pending, lines);
+			if(!(replying = reply(client, lines, out)))
+				break;
+		}
+		// the last line does not need a line break
+		if(replying && !pending.empty())
+		{
+			lines.push_back(pending);
+			reply(client, lines, out);
+		}
+		close(client);
+	}
+
+	bool reply(int client, vector<string>& lines, string& out)
+	{
+		if(lines.empty())
+			return true;
+		out.clear();
+		answerLines(_database, lines, out);
+		lines.clear();
+		const char* p = out.data();
+		size_t left = out.size();
+		while(left)
+		{
+			// a client gone before its answer must not kill the process with SIGPIPE
+			ssize_t written = send(client, p, left, MSG_NOSIGNAL);
+			if(written < 0 && errno == EINTR)
+				continue;
+			if(written <= 0)
+				return false;
+			p += written;
+			left -= written;
+		}
+		return true;
+	}
+
+private:
+	static const int _backlog = 64;
+
+	const KmerDatabase& _database;
+	string				_socketPath;
+	int					_fd;
+	std::atomic<bool>	_stopped;
+	std::list<Client>	_clients;	// only touched by the thread in run (and the destructor)
+};
+
+}
+
+#endif
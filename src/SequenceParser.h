@@ -0,0 +1,267 @@
+#ifndef SEQUENCEPARSER_H_
+#define SEQUENCEPARSER_H_
+
+#include <KmerCounter.h>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+namespace kmers
+{
+
+using std::vector;
+
+/*
+ * Raw:   the whole input is one sequence (line breaks are skipped)
+ * Fasta: '>' (or ';') header lines followed by any number of sequence lines
+ * Fastq: '@' header, sequence lines, '+' line, as many quality chars as there were bases
+ * Auto:  picked from the first char of the input
+ */
+enum class InputFormat
+{
+	Auto,
+	Raw,
+	Fasta,
+	Fastq
+};
+
+/*
+ * the sequence of a block: one segment per record (the line breaks inside a segment are still there)
+ * continued: segments.front() goes on with the record that was open at the end of the previous block
+ * open: the record of segments.back() goes on in the next block
+ */
+struct ParsedBlock
+{
+	ParsedBlock() : continued(false), open(false) {}
+	vector<Chunk> segments;
+	bool		  continued;
+	bool		  open;
+};
+
+/**
+ * Streaming parser stage between the reader and the counters: it is fed the blocks in order and cuts them into the
+ * sequence segments of the records - headers, '+' lines and quality lines are skipped, nothing is copied (the segments
+ * point into the block). The state is kept across blocks so records, headers and quality lines can span any number of
+ * block boundaries. Kmers are never counted across the end of a record: every segment is counted on its own, only the
+ * last one is rolled into the first segment of the next block when the record is still open.
+ */
+class SequenceParser
+{
+	enum class State
+	{
+		LineStart,		// beginning of a line (fasta: header or sequence, fastq: sequence or '+')
+		Header,			// inside a header line
+		Sequence,		// inside a sequence line
+		Plus,			// inside the '+' line of a fastq record
+		Quality,		// inside the quality lines of a fastq record
+		RecordStart		// fastq: between records, expecting '@'
+	};
+public:
+	SequenceParser(InputFormat format = InputFormat::Auto) : _format(format),
+															   _state(format == InputFormat::Fastq ? State::RecordStart : State::LineStart),
+															   _inRecord(false),
+															   _seqLength(0),
+															   _qualRemaining(0)
+	{
+	}
+
+	InputFormat format() const {return _format;}
+
+	void parse(const char* begin, const char* end, ParsedBlock& block)
+	{
+		block.segments.clear();
+		if(_format == InputFormat::Auto)
+			detect(begin, end);
+		bool wasInRecord = _inRecord;
+		if(_format == InputFormat::Raw)
+		{
+			if(begin != end)
+				block.segments.push_back(Chunk(begin, end, false));
+			_inRecord = true;
+		}
+		else if(_format == InputFormat::Fasta)
+			parseFasta(begin, end, block);
+		else
+			parseFastq(begin, end, block);
+		block.continued = wasInRecord && !block.segments.empty() && block.segments.front().begin() == begin;
+		// a record that only started at the very end has nothing in this block to go on with
+		block.open = _inRecord && !block.segments.empty() && block.segments.back().end() == end;
+	}
+
+private:
+	/*
+	 * the first non blank char decides - a first block of blanks only is taken for raw input
+	 */
+	void detect(const char* begin, const char* end)
+	{
+		for(const char* p = begin; p != end; ++p)
+		{
+			if(*p == '\n' || *p == '\r' || *p == ' ' || *p == '\t')
+				continue;
+			if(*p == '>' || *p == ';')
+				_format = InputFormat::Fasta;
+			else if(*p == '@')
+			{
+				_format = InputFormat::Fastq;
+				_state = State::RecordStart;
+			}
+			else
+				_format = InputFormat::Raw;
+			return;
+		}
+		_format = InputFormat::Raw;
+	}
+
+	void parseFasta(const char* begin, const char* end, ParsedBlock& block)
+	{
+		const char* segBegin = begin;
+		const char* p = begin;
+		while(p != end)
+		{
+			switch(_state)
+			{
+			case State::LineStart:
+				if(*p == '>' || *p == ';')
+				{
+					closeSegment(segBegin, p, block);
+					_state = State::Header;
+					++p;
+				}
+				else
+					_state = State::Sequence;
+				break;
+			case State::Header:
+				p = skipLine(p, end);
+				if(_state == State::LineStart)
+				{
+					_inRecord = true;
+					segBegin = p;
+				}
+				break;
+			default:
+				p = skipLine(p, end);
+				break;
+			}
+		}
+		if(_inRecord && segBegin != end)
+			block.segments.push_back(Chunk(segBegin, end, false));
+	}
+
+	void parseFastq(const char* begin, const char* end, ParsedBlock& block)
+	{
+		const char* segBegin = begin;
+		const char* p = begin;
+		while(p != end)
+		{
+			switch(_state)
+			{
+			case State::RecordStart:
+				if(*p == '@')
+					_state = State::Header;
+				else if(*p != '\n' && *p != '\r')
+					throw std::runtime_error("Malformed fastq record!");
+				++p;
+				break;
+			case State::Header:
+				p = skipLine(p, end);
+				if(_state == State::LineStart)
+				{
+					_inRecord = true;
+					_seqLength = 0;
+					segBegin = p;
+				}
+				break;
+			case State::LineStart:
+				if(*p == '+')
+				{
+					closeSegment(segBegin, p, block);
+					_state = State::Plus;
+					++p;
+				}
+				else
+					_state = State::Sequence;
+				break;
+			case State::Sequence:
+			{
+				const char* lineEnd = findLineEnd(p, end);
+				_seqLength += bases(p, lineEnd);
+				p = finishLine(lineEnd, end);
+				break;
+			}
+			case State::Plus:
+				p = skipLine(p, end);
+				if(_state == State::LineStart)
+				{
+					_state = State::Quality;
+					_qualRemaining = _seqLength;
+				}
+				break;
+			case State::Quality:
+			{
+				const char* lineEnd = findLineEnd(p, end);
+				size_t n = bases(p, lineEnd);
+				if(n > _qualRemaining)
+					throw std::runtime_error("Malformed fastq record: quality longer than the sequence!");
+				_qualRemaining -= n;
+				p = finishLine(lineEnd, end);
+				if(_state == State::LineStart)
+					_state = _qualRemaining ? State::Quality : State::RecordStart;
+				else
+					_state = State::Quality;
+				break;
+			}
+			}
+		}
+		if(_inRecord && segBegin != end)
+			block.segments.push_back(Chunk(segBegin, end, false));
+	}
+
+	/*
+	 * the record ends at p
+	 */
+	void closeSegment(const char* segBegin, const char* p, ParsedBlock& block)
+	{
+		if(_inRecord && segBegin != p)
+			block.segments.push_back(Chunk(segBegin, p, false));
+		_inRecord = false;
+	}
+
+	static inline const char* findLineEnd(const char* p, const char* end)
+	{
+		const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+		return nl ? nl : end;
+	}
+
+	/*
+	 * past the line break at lineEnd (if there is one in this block) - the next line starts there
+	 */
+	inline const char* finishLine(const char* lineEnd, const char* end)
+	{
+		if(lineEnd == end)
+			return end;
+		_state = State::LineStart;
+		return lineEnd + 1;
+	}
+
+	inline const char* skipLine(const char* p, const char* end)
+	{
+		return finishLine(findLineEnd(p, end), end);
+	}
+
+	static inline size_t bases(const char* begin, const char* end)
+	{
+		return (end - begin) - std::count(begin, end, '\r');
+	}
+
+private:
+	InputFormat _format;
+	State		_state;
+	bool		_inRecord;
+	size_t		_seqLength;
+	size_t		_qualRemaining;
+};
+
+}
+
+#endif
@@ -7,6 +7,8 @@
 #include <vector>
 #include <unordered_map>
 #include <utility>
+#include <sstream>
+#include <zlib.h>
 
 using std::string;
 using std::vector;
@@ -18,13 +20,23 @@ using namespace kmers;
 class TestingKmer
 {
 public:
-	TestingKmer(string filePath) : _f(filePath)
+	TestingKmer(string filePath)
 	{
-		_f >> _input;
+		// gzread reads plain files as they are
+		gzFile gz = gzopen(filePath.c_str(), "rb");
+		if(gz)
+		{
+			char buff[1 << 16];
+			int len;
+			while((len = gzread(gz, buff, sizeof(buff))) > 0)
+				_f.write(buff, len);
+			gzclose(gz);
+		}
+		_read();
 	}
-	void count(int n, int k)
+	void count(int n, int k, bool canonical = false)
 	{
-		_count(_input, n, k);
+		_count(_records, n, k, canonical);
 	}
 
 	vector<pair<string, size_t>> getResults() const {return _results;}
@@ -35,14 +47,67 @@ public:
 	}
 
 private:
-	void _count(string input, int n, int k)
+	// the sequence of every record: raw input is one record, fasta/fastq are split line by line
+	void _read()
+	{
+		string line;
+		vector<string> lines;
+		while(std::getline(_f, line))
+		{
+			if(!line.empty() && line[line.size()-1] == '\r')
+				line.erase(line.size()-1);
+			// the results are decoded lower case
+			std::transform(line.begin(), line.end(), line.begin(), ::tolower);
+			lines.push_back(line);
+		}
+		size_t first = 0;
+		while(first < lines.size() && lines[first].empty())
+			first++;
+		char format = first < lines.size() ? lines[first][0] : 0;
+		if(format == ';')
+			format = '>';
+		if(format != '>' && format != ';' && format != '@')
+		{
+			_records.push_back(string());
+			for(const string& l : lines)
+				_records.back() += l;
+			return;
+		}
+		for(size_t i=first;i<lines.size();)
+		{
+			if(lines[i].empty())
+			{
+				i++;
+				continue;
+			}
+			bool header = lines[i][0] == format || (format == '>' && lines[i][0] == ';');
+			if(!header)
+				throw std::runtime_error("Unexpected line in the test input!");
+			string seq;
+			for(i++;i<lines.size() && lines[i][0] != '>' && lines[i][0] != ';' && (format != '@' || lines[i][0] != '+');i++)
+				seq += lines[i];
+			if(format == '@')
+			{
+				size_t qual = 0;
+				for(i++;i<lines.size() && qual < seq.size();i++)
+					qual += lines[i].size();
+			}
+			_records.push_back(seq);
+		}
+	}
+
+	void _count(const vector<string>& records, int n, int k, bool canonical)
 	{
-		size_t len = input.size();
 		unordered_map<string, size_t> map;
-		for(int i=0;i<len-k+1;i++)
+		for(const string& input : records)
 		{
-			string s = input.substr(i, k);
-			map[s]+=1;
+			for(size_t i=0;i+k<=input.size();i++)
+			{
+				string s = input.substr(i, k);
+				if(canonical)
+					s = _canonical(s);
+				map[s]+=1;
+			}
 		}
 
 		vector<pair<string, size_t>> all;
@@ -55,6 +120,20 @@ private:
 
 	}
 
+	// the smaller of the kmer and its reverse complement in the order of the encoding: compared from the last char backwards by index
+	static string _canonical(const string& s)
+	{
+		string rc(s.rbegin(), s.rend());
+		for(char& c : rc)
+			c = elems[complementIndex(getIndex(c))];
+		for(int i=s.size()-1;i>=0;i--)
+		{
+			if(getIndex(s[i]) != getIndex(rc[i]))
+				return getIndex(rc[i]) < getIndex(s[i]) ? rc : s;
+		}
+		return s;
+	}
+
 	bool _compare(vector<pair<string, size_t>> other)
 	{
 		cout << "Number of elems in prod: " << other.size() << " vs " << _results.size() << endl;
@@ -107,8 +186,8 @@ private:
 
 
 private:
-	ifstream _f;
-	string _input;
+	std::stringstream _f;
+	vector<string> _records;
 	vector<pair<string, size_t>> _results;
 };
 
@@ -0,0 +1,110 @@
+#ifndef TOPN_H_
+#define TOPN_H_
+
+#include <set>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstddef>
+
+namespace kmers
+{
+
+/**
+ * Single pass selection of the elements having one of the n biggest distinct counts - all the ties included, so the
+ * result can hold more than n elements. The n biggest distinct counts seen so far are kept in a small ordered set
+ * (a bounded heap of the levels): anything below its smallest level is dropped in O(1), the survivors are collected and
+ * the ones that fell below the (rising) threshold are pruned lazily. O(N + candidates * log n) instead of a full scan per
+ * count level.
+ *
+ * CountOf: functor giving the count of an element
+ */
+template<class T, class CountOf>
+class TopNSelector
+{
+public:
+	TopNSelector(size_t n, CountOf countOf = CountOf()) : _n(n), _threshold(0), _pruneAt(1024), _countOf(countOf) {}
+
+	inline void add(const T& elem)
+	{
+		if(!_n)
+			return;
+		size_t count = _countOf(elem);
+		if(_levels.size() == _n)
+		{
+			if(count < _threshold)
+				return;
+			if(count > _threshold && _levels.insert(count).second)
+			{
+				_levels.erase(_levels.begin());
+				_threshold = *_levels.begin();
+			}
+		}
+		else
+		{
+			_levels.insert(count);
+			_threshold = *_levels.begin();
+		}
+		_candidates.push_back(elem);
+		if(_candidates.size() >= _pruneAt)
+		{
+			prune();
+			_pruneAt = std::max(_pruneAt, _candidates.size() * 2);
+		}
+	}
+
+	template<class It>
+	void add(It begin, It end)
+	{
+		for(;begin!=end;++begin)
+			add(*begin);
+	}
+
+	/*
+	 * smallest count still making it into the result (0 while nothing was added)
+	 */
+	size_t threshold() const {return _threshold;}
+
+	/*
+	 * the selected elements, biggest count first
+	 */
+	std::vector<T> result()
+	{
+		prune();
+		std::vector<T> res;
+		res.swap(_candidates);
+		std::stable_sort(res.begin(), res.end(), [this](const T& lhs, const T& rhs) {return _countOf(lhs) > _countOf(rhs);});
+		return res;
+	}
+
+private:
+	void prune()
+	{
+		size_t threshold = _threshold;
+		CountOf& countOf = _countOf;
+		_candidates.erase(std::remove_if(_candidates.begin(), _candidates.end(),
+										 [threshold, &countOf](const T& elem) {return countOf(elem) < threshold;}),
+						  _candidates.end());
+	}
+
+private:
+	size_t			 _n;
+	size_t			 _threshold;
+	size_t			 _pruneAt;
+	std::set<size_t> _levels;
+	std::vector<T>	 _candidates;
+	CountOf			 _countOf;
+};
+
+/*
+ * count of the (element, count) pairs
+ */
+struct PairCount
+{
+	template<class T>
+	size_t operator()(const std::pair<T, size_t>& p) const {return p.second;}
+};
+
+}
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef WORKERPOOL_H_
+#define WORKERPOOL_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <exception>
+
+namespace kmers
+{
+
+using std::thread;
+using std::mutex;
+using std::unique_lock;
+using std::lock_guard;
+using std::condition_variable;
+using std::atomic;
+using std::deque;
+using std::vector;
+using std::unique_ptr;
+
+/**
+ * Fixed set of long lived worker threads. Every worker has its own deque of tasks: it takes from the front of its own
+ * deque and once that is empty it steals from the back of the others. Tasks get the id of the worker running them
+ * (0..size()-1) so they can keep per worker state (e.g. the counting tables) across tasks without any locking.
+ *
+ * maxQueued bounds the number of tasks waiting in the deques - submit blocks while the bound is reached so a fast
+ * producer can not run away from the workers. Several producers can share the pool, each one waiting for the tasks of
+ * its own Group only. A task of a group that throws fails just that group: the error is kept for its producer and the
+ * rest of its tasks are dropped without running, the other groups go on.
+ */
+class WorkerPool
+{
+public:
+	using Task = std::function<void(size_t)>;
+
+	/*
+	 * tasks submitted together that can be waited for apart from the others in the pool
+	 */
+	class Group
+	{
+	public:
+		Group() : _unfinished(0) {}
+
+		Group(const Group&) = delete;
+		Group& operator=(const Group&) = delete;
+
+	private:
+		friend class WorkerPool;
+
+		mutex			   _mutex;
+		condition_variable _condvarIdle;
+		size_t			   _unfinished;
+		std::exception_ptr _error;		// the first one a task of the group threw
+	};
+
+	WorkerPool(size_t numOfWorkers, size_t maxQueued) : _maxQueued(maxQueued ? maxQueued : 1),
+														 _queued(0),
+														 _unfinished(0),
+														 _nextWorker(0),
+														 _stop(false)
+	{
+		if(!numOfWorkers)
+			numOfWorkers = 1;
+		for(size_t i=0;i<numOfWorkers;i++)
+			_workers.push_back(unique_ptr<Worker>(new Worker()));
+		for(size_t i=0;i<numOfWorkers;i++)
+			_workers[i]->handle = thread(&WorkerPool::run, this, i);
+	}
+
+	~WorkerPool()
+	{
+		{
+			lock_guard<mutex> lock(_mutex);
+			_stop = true;
+			_condvarWork.notify_all();
+		}
+		for(auto& w : _workers)
+			w->handle.join();
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	size_t size() const {return _workers.size();}
+
+	// tasks waiting for a worker
+	size_t queued()
+	{
+		lock_guard<mutex> lock(_mutex);
+		return _queued;
+	}
+
+	/*
+	 * queues the task round robin - might block if there are maxQueued tasks waiting already
+	 */
+	void submit(Task task)
+	{
+		size_t w = _nextWorker++ % _workers.size();
+		{
+			unique_lock<mutex> lock(_mutex);
+			while(_queued >= _maxQueued)
+				_condvarSpace.wait(lock);
+			++_queued;
+			++_unfinished;
+		}
+		{
+			lock_guard<mutex> lock(_workers[w]->tasksMutex);
+			_workers[w]->tasks.push_back(std::move(task));
+		}
+		lock_guard<mutex> lock(_mutex);
+		_condvarWork.notify_one();
+	}
+
+	/*
+	 * the task counts as unfinished for the group until it has run and everything it holds is gone - it does not run
+	 * at all once a task of the group has failed
+	 */
+	void submit(Group& group, Task task)
+	{
+		{
+			lock_guard<mutex> lock(group._mutex);
+			++group._unfinished;
+		}
+		submit([&group, task](size_t worker) mutable
+			   {
+					bool failed;
+					{
+						lock_guard<mutex> lock(group._mutex);
+						failed = (bool)group._error;
+					}
+					if(!failed)
+					{
+						try
+						{
+							task(worker);
+						}
+						catch(...)
+						{
+							lock_guard<mutex> lock(group._mutex);
+							if(!group._error)
+								group._error = std::current_exception();
+						}
+					}
+					task = nullptr;
+					lock_guard<mutex> lock(group._mutex);
+					if(--group._unfinished == 0)
+						group._condvarIdle.notify_all();
+			   });
+	}
+
+	/*
+	 * blocks until every submitted task has finished
+	 */
+	void waitIdle()
+	{
+		unique_lock<mutex> lock(_mutex);
+		while(_unfinished)
+			_condvarIdle.wait(lock);
+	}
+
+	/*
+	 * blocks until every task of the group has finished - throws the error a task of it failed with (once, the group
+	 * can be used again after that)
+	 */
+	void waitIdle(Group& group)
+	{
+		unique_lock<mutex> lock(group._mutex);
+		while(group._unfinished)
+			group._condvarIdle.wait(lock);
+		if(group._error)
+		{
+			std::exception_ptr error = group._error;
+			group._error = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+
+private:
+	struct Worker
+	{
+		mutex		 tasksMutex;
+		deque<Task>  tasks;
+		thread		 handle;
+	};
+
+	bool popOwn(size_t id, Task& task)
+	{
+		Worker& w = *_workers[id];
+		lock_guard<mutex> lock(w.tasksMutex);
+		if(w.tasks.empty())
+			return false;
+		task = std::move(w.tasks.front());
+		w.tasks.pop_front();
+		return true;
+	}
+
+	bool steal(size_t id, Task& task)
+	{
+		for(size_t i=1;i<_workers.size();i++)
+		{
+			Worker& victim = *_workers[(id + i) % _workers.size()];
+			lock_guard<mutex> lock(victim.tasksMutex);
+			if(victim.tasks.empty())
+				continue;
+			task = std::move(victim.tasks.back());
+			victim.tasks.pop_back();
+			return true;
+		}
+		return false;
+	}
+
+	void run(size_t id)
+	{
+		Task task;
+		while(true)
+		{
+			if(popOwn(id, task) || steal(id, task))
+			{
+				{
+					lock_guard<mutex> lock(_mutex);
+					--_queued;
+					_condvarSpace.notify_one();
+				}
+				task(id);
+				task = nullptr;
+				lock_guard<mutex> lock(_mutex);
+				if(--_unfinished == 0)
+					_condvarIdle.notify_all();
+				continue;
+			}
+
+			unique_lock<mutex> lock(_mutex);
+			// a task is only counted in _queued once it is in a deque (or about to be) so recheck before sleeping
+			while(!_stop && !_queued)
+				_condvarWork.wait(lock);
+			if(_stop && !_queued)
+				return;
+		}
+	}
+
+private:
+	vector<unique_ptr<Worker>> _workers;
+	size_t				_maxQueued;
+	size_t				_queued;
+	size_t				_unfinished;
+	atomic<size_t>		_nextWorker;
+	bool				_stop;
+	mutex				_mutex;
+	condition_variable	_condvarWork;
+	condition_variable	_condvarSpace;
+	condition_variable	_condvarIdle;
+};
+
+}
+
+#endif
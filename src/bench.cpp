@@ -0,0 +1,436 @@
+/*
+ * bench.cpp
+ *
+ * Micro benchmarks of the building blocks of the counter and end to end runs of the engine over generated inputs.
+ * Prints one tab separated line per benchmark (the first line names the columns) - the inputs are generated from
+ * fixed seeds and every number is the best of --repeat runs, so the output of two builds can be compared line by line.
+ */
+
+#include <KmerEngine.h>
+#include <KmerCounter.h>
+#include <FlatHashMap.h>
+#include <MerMap.h>
+#include <FileSerializer.h>
+#include <Mer.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <map>
+
+using namespace kmers;
+using namespace std;
+
+namespace
+{
+
+struct Options
+{
+	Options() : repeat(3), quick(false) {}
+	size_t repeat;
+	bool   quick;
+	string filter;
+	vector<size_t> threads;		// of the engine runs (empty: 1, 2, 4... up to the cores)
+};
+
+Options options;
+// results go here so the compiler can not drop the work
+volatile size_t sink;
+
+/*
+ * the engine's progress output is dropped for the scope - cout gets its buffer back however the scope is left
+ */
+class MutedCout
+{
+public:
+	MutedCout() : _coutBuf(cout.rdbuf(_null.rdbuf())) {}
+	~MutedCout() {cout.rdbuf(_coutBuf);}
+
+	MutedCout(const MutedCout&) = delete;
+	MutedCout& operator=(const MutedCout&) = delete;
+
+private:
+	std::ofstream	_null;
+	std::streambuf* _coutBuf;
+};
+
+/*
+ * the same sequence for the same seed on every platform (not rand)
+ */
+class SequenceGenerator
+{
+public:
+	SequenceGenerator(uint64_t seed) : _state(seed) {}
+
+	inline uint64_t next()
+	{
+		_state = _state * 6364136223846793005ULL + 1442695040888963407ULL;
+		return _state >> 33;
+	}
+
+	string bases(size_t len)
+	{
+		static const char acgt[] = {'a', 'c', 'g', 't'};
+		string s(len, 'a');
+		for(size_t i=0;i<len;i++)
+			s[i] = acgt[next() & 3];
+		return s;
+	}
+
+private:
+	uint64_t _state;
+};
+
+/*
+ * random bases in lines of 80 with a copy of one of a few repeats every kilobase or so (so the counts are not all 1s)
+ */
+string generateInput(size_t size, uint64_t seed)
+{
+	SequenceGenerator gen(seed);
+	vector<string> repeats;
+	for(size_t i=0;i<64;i++)
+		repeats.push_back(gen.bases(200));
+	string seq;
+	seq.reserve(size);
+	while(seq.size() < size)
+	{
+		seq += gen.bases(800 + gen.next() % 400);
+		seq += repeats[gen.next() % repeats.size()];
+	}
+	seq.resize(size);
+	string out;
+	out.reserve(size + size / 80 + 1);
+	for(size_t i=0;i<seq.size();i+=80)
+	{
+		out.append(seq, i, 80);
+		out += '\n';
+	}
+	return out;
+}
+
+bool selected(const string& name)
+{
+	return options.filter.empty() || name.find(options.filter) != string::npos;
+}
+
+/*
+ * runs fn (doing ops operations) repeat times and prints the best one
+ */
+template<class Fn>
+void run(const string& name, const string& params, size_t ops, Fn fn)
+{
+	if(!selected(name))
+		return;
+	double best = 0;
+	for(size_t r=0;r<options.repeat;r++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if(r == 0 || seconds < best)
+			best = seconds;
+	}
+	printf("%s\t%s\t%lu\t%.6f\t%.2f\t%.2f\n", name.c_str(), params.c_str(), (unsigned long)ops, best,
+		   best * 1e9 / ops, ops / best / 1e6);
+	fflush(stdout);
+}
+
+string params(size_t k, const string& more = string())
+{
+	std::ostringstream s;
+	s << "k=" << k;
+	if(!more.empty())
+		s << "," << more;
+	return s.str();
+}
+
+template<class Mer>
+void benchMer(size_t k, const string& seq, size_t numOfKmers)
+{
+	vector<Mer> mers(numOfKmers);
+	run("encode", params(k), numOfKmers, [&]()
+		{
+			for(size_t i=0;i<numOfKmers;i++)
+				mers[i] = encode<Mer>(seq.c_str() + i, k);
+		});
+
+	run("decode", params(k), numOfKmers, [&]()
+		{
+			size_t total = 0;
+			for(size_t i=0;i<numOfKmers;i++)
+				total += decode(mers[i], k)[0];
+			sink = total;
+		});
+
+	run("hash", params(k), numOfKmers, [&]()
+		{
+			mer_encoded_hash<Mer> hash;
+			size_t total = 0;
+			for(size_t i=0;i<numOfKmers;i++)
+				total += hash(mers[i]);
+			sink = total;
+		});
+
+	run("table_insert", params(k), numOfKmers, [&]()
+		{
+			FlatHashMap<Mer, size_t, mer_encoded_hash<Mer>> table;
+			table.max_load_factor(0.7f);
+			table.reserve(numOfKmers);
+			for(size_t i=0;i<numOfKmers;i++)
+				++table[mers[i]];
+			sink = table.size();
+		});
+
+	// rolling + inserting as the workers do it
+	run("counter", params(k), seq.size(), [&]()
+		{
+			KmerCounter<Mer> counter(k, 10, HashTableConfig(numOfKmers, 0.7f));
+			counter.count(Chunk(seq.data(), seq.data() + seq.size(), false), Chunk());
+			sink = counter.size();
+		});
+
+	MerMap<Mer> map(k);
+	map.reserve(numOfKmers);
+	for(size_t i=0;i<numOfKmers;i++)
+		++map[mers[i]];
+	run("extract", params(k, "n=10"), map.size(), [&]()
+		{
+			sink = map.extract(10).size();
+		});
+
+	// a spill and reading it back as the merge does
+	string file = "bench_run_" + std::to_string(k);
+	size_t records = map.size();
+	run("serialize", params(k), records, [&]()
+		{
+			SerializationInfo si = FileSerializer::write(map, file);
+			RunReader<mer_count<Mer>> reader(si);
+			size_t total = 0;
+			for(; reader.valid(); reader.advance())
+				total += reader.current().count;
+			sink = total;
+		});
+	remove(file.c_str());
+}
+
+void benchMers()
+{
+	size_t numOfKmers = options.quick ? 1 << 18 : 1 << 21;
+	SequenceGenerator gen(42);
+	string seq = gen.bases(numOfKmers + 128);
+	benchMer<mer32>(10, seq, numOfKmers);
+	benchMer<mer64>(21, seq, numOfKmers);
+	benchMer<mer128>(31, seq, numOfKmers);
+	benchMer<mer256>(63, seq, numOfKmers);
+}
+
+/*
+ * several k over the same sequence (in lines) by their counters: each one scanning it on its own or all of them fed from
+ * a single scan as the engine does it - and the scan alone, the part the single scan saves
+ */
+void benchMultiK()
+{
+	size_t size = options.quick ? 1 << 18 : 1 << 21;
+	string input = generateInput(size, 7);
+	const char* begin = input.data();
+	const char* end = input.data() + input.size();
+	HashTableConfig config(size, 0.7f);
+
+	run("scan", "lines=80", input.size(), [&]()
+		{
+			BaseScanner scanner;
+			size_t total = 0;
+			scanner.scan(begin, end, [&total](const uint8_t* codes, size_t len) { total += codes[len / 2]; });
+			sink = total;
+		});
+
+	run("counter_multi_k", "k=12+21+31,scans=3", input.size(), [&]()
+		{
+			KmerCounter<mer64> c12(12, 10, config);
+			KmerCounter<mer64> c21(21, 10, config);
+			KmerCounter<mer128> c31(31, 10, config);
+			c12.count(Chunk(begin, end, false), Chunk());
+			c21.count(Chunk(begin, end, false), Chunk());
+			c31.count(Chunk(begin, end, false), Chunk());
+			sink = c12.size() + c21.size() + c31.size();
+		});
+
+	run("counter_multi_k", "k=12+21+31,scans=1", input.size(), [&]()
+		{
+			KmerCounter<mer64> c12(12, 10, config);
+			KmerCounter<mer64> c21(21, 10, config);
+			KmerCounter<mer128> c31(31, 10, config);
+			CodeSink* sinks[] = {&c12, &c21, &c31};
+			BaseScanner scanner;
+			for(CodeSink* s : sinks)
+				s->beginRecord();
+			scanner.scan(begin, end, [&sinks](const uint8_t* codes, size_t len)
+						 {
+							for(CodeSink* s : sinks)
+								s->countCodes(codes, len);
+						 });
+			for(CodeSink* s : sinks)
+				s->endRecord(nullptr, 0);
+			sink = c12.size() + c21.size() + c31.size();
+		});
+}
+
+/*
+ * the thread counts of --threads, or the powers of two below the cores and the cores themselves
+ */
+vector<size_t> threadCounts()
+{
+	if(!options.threads.empty())
+		return options.threads;
+	size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+	vector<size_t> threads;
+	for(size_t t = 1; t < cores; t <<= 1)
+		threads.push_back(t);
+	threads.push_back(cores);
+	return threads;
+}
+
+/*
+ * whole runs of the engine (top 10) over a sweep of thread counts - the engine reports its progress on cout, that is
+ * not part of the output
+ */
+void benchEngine()
+{
+	vector<size_t> sizes = options.quick ? vector<size_t>{4 << 20} : vector<size_t>{8 << 20, 32 << 20};
+	vector<size_t> ks = {12, 21, 31};
+	vector<size_t> threads = threadCounts();
+
+	for(size_t size : sizes)
+	{
+		string path = "bench_input_" + std::to_string(size >> 20);
+		{
+			string input = generateInput(size, size);
+			ofstream out(path.c_str(), std::ios_base::binary);
+			out.write(input.data(), input.size());
+		}
+		for(size_t k : ks)
+		{
+			for(size_t t : threads)
+			{
+				std::ostringstream more;
+				more << "threads=" << t << ",mb=" << (size >> 20);
+				// engine: worker tables merged by the partitions, engine_shared: one lock-free table (--shared-table)
+				for(bool shared : {false, true})
+				{
+					EngineConfig config;
+					config.sharedTable = shared;
+					run(shared ? "engine_shared" : "engine", params(k, more.str()), size, [&]()
+						{
+							MutedCout muted;
+							KmerEngine engine(path, k, 10, t, config);
+							engine.start();
+							sink = engine.getResults().size();
+						});
+				}
+			}
+		}
+		run("engine_multi_k", "k=12+21+31,threads=1,mb=" + std::to_string(size >> 20), size, [&]()
+			{
+				MutedCout muted;
+				KmerEngine engine(path, ks, 10, 1);
+				engine.start();
+				for(size_t k : ks)
+					sink = engine.getResults(k).size();
+			});
+		remove(path.c_str());
+	}
+}
+
+/*
+ * ns per operation of every benchmark of an output by "benchmark\tparams"
+ */
+map<string, double> readResults(const string& path)
+{
+	ifstream in(path.c_str());
+	if(!in)
+		throw std::runtime_error("Could not read " + path);
+	map<string, double> results;
+	string line;
+	getline(in, line);
+	while(getline(in, line))
+	{
+		vector<string> fields;
+		std::istringstream s(line);
+		string field;
+		while(getline(s, field, '\t'))
+			fields.push_back(field);
+		if(fields.size() >= 5)
+			results[fields[0] + "\t" + fields[1]] = atof(fields[4].c_str());
+	}
+	return results;
+}
+
+/*
+ * the change of every benchmark in both outputs - positive is slower
+ */
+int diff(const string& basePath, const string& newPath)
+{
+	map<string, double> base = readResults(basePath);
+	map<string, double> current = readResults(newPath);
+	printf("benchmark\tparams\tbase_ns_per_op\tns_per_op\tchange_percent\n");
+	for(const auto& p : current)
+	{
+		auto it = base.find(p.first);
+		if(it == base.end() || it->second <= 0)
+			continue;
+		printf("%s\t%.2f\t%.2f\t%+.1f\n", p.first.c_str(), it->second, p.second, (p.second / it->second - 1) * 100);
+	}
+	return 0;
+}
+
+void usage(const char* prog)
+{
+	cout << "usage: " << prog << " [--quick] [--repeat R] [--filter NAME] [--threads T[,T...]]\n"
+		 << "       " << prog << " --diff BASE NEW\n"
+		 << "columns: benchmark, parameters, operations (kmers, records or input bytes), best seconds, ns per operation,\n"
+		 << "million operations per second - --diff compares two saved outputs. The engine runs go over 1, 2, 4... threads\n"
+		 << "up to the cores unless --threads lists the counts\n";
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	for(int i=1;i<argc;i++)
+	{
+		string arg(argv[i]);
+		if(arg == "--quick")
+			options.quick = true;
+		else if(arg == "--repeat" && i+1 < argc)
+			options.repeat = std::max(atoi(argv[++i]), 1);
+		else if(arg == "--filter" && i+1 < argc)
+			options.filter = argv[++i];
+		else if(arg == "--threads" && i+1 < argc)
+		{
+			std::istringstream list(argv[++i]);
+			string t;
+			while(getline(list, t, ','))
+				options.threads.push_back(std::max(atoi(t.c_str()), 1));
+		}
+		else if(arg == "--diff" && i+2 < argc)
+			return diff(argv[i+1], argv[i+2]);
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	printf("benchmark\tparams\tops\tseconds\tns_per_op\tmops_per_s\n");
+	benchMers();
+	benchMultiK();
+	benchEngine();
+	return 0;
+}
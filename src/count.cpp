@@ -6,6 +6,7 @@
  */
 
 #include <KmerEngine.h>
+#include <KmerBatch.h>
 #include <Mer.h>
 
 #ifdef _TESTING
@@ -20,29 +21,213 @@
 using namespace kmers;
 using namespace std;
 
+static void usage(const char* prog)
+{
+	cout << "usage: " << prog << " <file> <n> <k[,k...]> [--threads T] [--max-memory MB] [--mmap | --pread [--io-threads N]] [--partitions P | --shared-table] [--canonical]\n"
+		 << "       [--format auto|raw|fasta|fastq] [--output-db PATH] [--histogram PATH]\n"
+		 << "       [--approximate [--sketch-memory MB] [--sketch-error EPS] [--query KMER]...]\n"
+		 << "       [--prefilter [--prefilter-memory MB] [--fixup]] [--metrics PATH] [--metrics-interval SEC]\n"
+		 << "       [--spill-prefix PREFIX] [--batch [--files-at-once F]]\n"
+		 << "several k (comma separated) are counted in the same pass over the file, n can be 0 for just the histogram\n"
+		 << "--batch: <file> is a manifest of inputs (a path and optionally a name per line) counted on the same threads, the\n"
+		 << "outputs of every input go to <PATH>.<name>\n";
+}
+
+static vector<size_t> parseKs(const string& arg)
+{
+	vector<size_t> ks;
+	size_t begin = 0;
+	while(begin <= arg.size())
+	{
+		size_t end = arg.find(',', begin);
+		if(end == string::npos)
+			end = arg.size();
+		ks.push_back(atoi(arg.substr(begin, end - begin).c_str()));
+		begin = end + 1;
+	}
+	return ks;
+}
+
+/*
+ * every input of the manifest by an engine of its own on shared workers - the report of an input comes in one piece
+ * once it is done
+ */
+static int countBatch(const string& manifest, int n, const vector<size_t>& ks, int threadCount, const EngineConfig& config,
+					  size_t filesAtOnce)
+{
+	KmerBatch batch(KmerBatch::readManifest(manifest), ks, n, threadCount, config, filesAtOnce);
+	size_t failed = 0;
+	batch.run([&](const BatchResult& r)
+			  {
+				cout << "Input " << r.input.name << " (" << r.input.path << "):\n" << r.log;
+				if(!r.error.empty())
+				{
+					cout << "Failed: " << r.error << endl;
+					++failed;
+					return;
+				}
+				for(size_t i=0;i<ks.size();i++)
+				{
+					if(ks.size() > 1)
+						cout << "Results for k=" << ks[i] << ":\n";
+					for(const auto& p : r.results[i])
+						cout << p.first << "," << p.second << "\n";
+				}
+#ifdef _TESTING
+				bool pass = true;
+				for(size_t i=0;i<ks.size();i++)
+				{
+					TestingKmer tester(r.input.path);
+					tester.count(n, ks[i], config.canonical);
+					pass = tester.compare(r.results[i]) && pass;
+				}
+				cout << (pass ? "Test passed!\n" : "Test failed!\n");
+				if(!pass)
+					++failed;
+#endif
+				cout << flush;
+			  });
+	cout << "Finished " << batch.inputs().size() - failed << " of " << batch.inputs().size() << " inputs!\n";
+	return failed ? 1 : 0;
+}
+
 int main(int argc, char** argv)
 {
+	if(argc < 4)
+	{
+		usage(argv[0]);
+		return 1;
+	}
 	string file = string(argv[1]);
 	int n = atoi(argv[2]);
-	int k = atoi(argv[3]);
+	vector<size_t> ks = parseKs(argv[3]);
 	int threadCount = 4;
 
-	KmerEngine engine(file, k, n, threadCount);
-	engine.start();
-	cout << "Finished processing now comes the result combination!\n";
-	vector<pair<string, size_t>> results = engine.getResults();
-	unsigned long long totalkmerCount = engine.totalKmerCount();
+	EngineConfig config;
+	vector<string> queries;
+	bool batch = false;
+	size_t filesAtOnce = 0;
+	for(int i=4;i<argc;i++)
+	{
+		string arg(argv[i]);
+		if(arg == "--mmap")
+			config.inputMode = InputMode::Mmap;
+		else if(arg == "--batch")
+			batch = true;
+		else if(arg == "--files-at-once" && i+1 < argc)
+			filesAtOnce = atoi(argv[++i]);
+		else if(arg == "--spill-prefix" && i+1 < argc)
+			config.spillPrefix = argv[++i];
+		else if(arg == "--pread")
+			config.inputMode = InputMode::Pread;
+		else if(arg == "--io-threads" && i+1 < argc)
+			config.ioThreads = atoi(argv[++i]);
+		else if(arg == "--canonical")
+			config.canonical = true;
+		else if(arg == "--threads" && i+1 < argc)
+			threadCount = atoi(argv[++i]);
+		else if(arg == "--max-memory" && i+1 < argc)
+			config.maxMemory = (size_t)atol(argv[++i]) << 20;
+		else if(arg == "--output-db" && i+1 < argc)
+			config.databasePath = argv[++i];
+		else if(arg == "--histogram" && i+1 < argc)
+			config.histogramPath = argv[++i];
+		else if(arg == "--metrics" && i+1 < argc)
+			config.metricsPath = argv[++i];
+		else if(arg == "--metrics-interval" && i+1 < argc)
+			config.metricsInterval = atof(argv[++i]);
+		else if(arg == "--shared-table")
+			config.sharedTable = true;
+		else if(arg == "--partitions" && i+1 < argc)
+			config.numOfPartitions = atoi(argv[++i]);
+		else if(arg == "--approximate")
+			config.approximate = true;
+		else if(arg == "--sketch-memory" && i+1 < argc)
+			config.sketchMemory = (size_t)atol(argv[++i]) << 20;
+		else if(arg == "--sketch-error" && i+1 < argc)
+			config.sketchError = atof(argv[++i]);
+		else if(arg == "--prefilter")
+			config.prefilter = true;
+		else if(arg == "--prefilter-memory" && i+1 < argc)
+			config.prefilterMemory = (size_t)atol(argv[++i]) << 20;
+		else if(arg == "--fixup")
+			config.fixup = true;
+		else if(arg == "--query" && i+1 < argc)
+			queries.push_back(argv[++i]);
+		else if(arg == "--format" && i+1 < argc)
+		{
+			string format(argv[++i]);
+			if(format == "auto")
+				config.format = InputFormat::Auto;
+			else if(format == "raw")
+				config.format = InputFormat::Raw;
+			else if(format == "fasta")
+				config.format = InputFormat::Fasta;
+			else if(format == "fastq")
+				config.format = InputFormat::Fastq;
+			else
+			{
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
-	for(const auto& p : results)
+	if(batch && !queries.empty())
 	{
-		cout << p.first << "," << p.second << endl;
+		usage(argv[0]);
+		return 1;
+	}
+
+	vector<vector<pair<string, size_t>>> results;
+	try
+	{
+		if(batch)
+			return countBatch(file, n, ks, threadCount, config, filesAtOnce);
+
+		KmerEngine engine(file, ks, n, threadCount, config);
+		engine.start();
+		cout << "Finished processing now comes the result combination!\n";
+		for(size_t k : ks)
+		{
+			results.push_back(engine.getResults(k));
+			if(ks.size() > 1)
+				cout << "Results for k=" << k << ":\n";
+			for(const auto& p : results.back())
+			{
+				cout << p.first << "," << p.second << endl;
+			}
+		}
+		if(config.approximate)
+		{
+			cout << "Estimated counts: at most " << engine.errorBound() << " above the true count with probability "
+				 << engine.errorConfidence() << endl;
+			for(const string& q : queries)
+				cout << "query " << q << "," << engine.estimate(q) << endl;
+		}
+		engine.writeMetrics();
+	}
+	catch(const std::exception& e)
+	{
+		cout << flush;
+		cerr << "Failed: " << e.what() << endl;
+		return 1;
 	}
 	cout << "Finished!\n";
 
 #ifdef _TESTING
-	TestingKmer tester(file);
-	tester.count(n, k);
-	bool pass = tester.compare(results);
+	bool pass = true;
+	for(size_t i=0;i<ks.size();i++)
+	{
+		TestingKmer tester(file);
+		tester.count(n, ks[i], config.canonical);
+		pass = tester.compare(results[i]) && pass;
+	}
 
 	//vector<pair<string, size_t>> testresults = tester.getResults();
 	/*cout << "test results:\n";
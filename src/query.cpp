@@ -0,0 +1,118 @@
+/*
+ * query.cpp
+ *
+ * Looks up kmers in a database written by count --output-db.
+ */
+
+#include <KmerDatabase.h>
+#include <QueryServer.h>
+#include <StopWatch.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+
+using namespace kmers;
+using namespace std;
+
+static const size_t batchSize = 1 << 16;
+
+static void usage(const char* prog)
+{
+	cout << "usage: " << prog << " <database> [--stats] [KMER...]\n"
+		 << "       " << prog << " <database> --serve SOCKET\n"
+		 << "without kmers the kmers are read from the standard input (one per line, a count per line is printed)\n";
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	string socketPath;
+	bool stats = false;
+	vector<string> kmers;
+	for(int i=2;i<argc;i++)
+	{
+		string arg(argv[i]);
+		if(arg == "--serve" && i+1 < argc)
+			socketPath = argv[++i];
+		else if(arg == "--stats")
+			stats = true;
+		else if(arg.compare(0, 2, "--") != 0)
+			kmers.push_back(arg);
+		else
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	try
+	{
+		KmerDatabase database(argv[1]);
+		if(!socketPath.empty())
+		{
+			QueryServer server(database, socketPath);
+			cerr << "Serving " << argv[1] << " (k=" << database.k() << ", " << database.numOfKmers() << " kmers) on " << socketPath << endl;
+			server.run();
+			return 0;
+		}
+
+		StopWatch<std::chrono::microseconds> watch;
+		size_t lookups = 0;
+		size_t elapsed = 0;
+		if(!kmers.empty())
+		{
+			vector<string> lines(kmers);
+			string out;
+			watch.start();
+			answerLines(database, lines, out);
+			elapsed += watch.stop();
+			lookups += kmers.size();
+			size_t pos = 0;
+			for(const string& kmer : kmers)
+			{
+				size_t nl = out.find('\n', pos);
+				cout << kmer << "," << out.substr(pos, nl - pos) << "\n";
+				pos = nl + 1;
+			}
+		}
+		else
+		{
+			// in batches, so the lookups of a batch can overlap
+			vector<string> lines;
+			string out;
+			string line;
+			bool more = true;
+			while(more)
+			{
+				lines.clear();
+				while(lines.size() < batchSize && (more = (bool)getline(cin, line)))
+					lines.push_back(line);
+				if(lines.empty())
+					break;
+				lookups += lines.size();
+				out.clear();
+				watch.start();
+				answerLines(database, lines, out);
+				elapsed += watch.stop();
+				fwrite(out.data(), 1, out.size(), stdout);
+			}
+		}
+		cout.flush();
+		if(stats)
+			cerr << lookups << " lookups in " << elapsed / 1000.0 << " ms ("
+				 << (elapsed ? (size_t)(lookups * 1e6 / elapsed) : 0) << " per second)" << endl;
+		return 0;
+	}
+	catch(const std::exception& e)
+	{
+		cout << flush;
+		cerr << "Failed: " << e.what() << endl;
+		return 1;
+	}
+}
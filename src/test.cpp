@@ -0,0 +1,396 @@
+/*
+ * test.cpp
+ *
+ * Checks of the error paths of the counter - the inputs are written into the working directory, every check prints
+ * one line and the exit status is 1 if any of them failed. The counts themselves are checked by count built with
+ * -D_TESTING (see TestingKmer).
+ */
+
+#include <KmerEngine.h>
+#include <KmerBatch.h>
+#include <FileIO.h>
+#include <KmerDatabase.h>
+
+#include <zlib.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <functional>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+
+using namespace kmers;
+using namespace std;
+
+namespace
+{
+
+size_t failures = 0;
+
+void check(const string& name, bool passed, const string& detail = string())
+{
+	cout << (passed ? "passed\t" : "FAILED\t") << name;
+	if(!passed && !detail.empty())
+		cout << "\t" << detail;
+	cout << endl;
+	if(!passed)
+		++failures;
+}
+
+/*
+ * the error fn throws (empty if it does not)
+ */
+string errorOf(const std::function<void()>& fn)
+{
+	try
+	{
+		fn();
+	}
+	catch(const std::exception& e)
+	{
+		return e.what();
+	}
+	return string();
+}
+
+void expectError(const string& name, const string& expected, const std::function<void()>& fn)
+{
+	string error = errorOf(fn);
+	check(name, error.find(expected) != string::npos, error.empty() ? "no error" : error);
+}
+
+/*
+ * bases in lines of 80 - the same ones every run
+ */
+string sequence(size_t size)
+{
+	static const char acgt[] = {'a', 'c', 'g', 't'};
+	uint64_t state = 42;
+	string s;
+	s.reserve(size + size / 80 + 1);
+	for(size_t i=0;i<size;i++)
+	{
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		s += acgt[(state >> 33) & 3];
+		if(i % 80 == 79)
+			s += '\n';
+	}
+	return s;
+}
+
+void writeFile(const string& path, const string& data)
+{
+	ofstream out(path.c_str(), std::ios_base::binary);
+	out.write(data.data(), data.size());
+}
+
+/*
+ * windowBits 15+16: a gzip member, -15: raw deflate (the data of a bgzf member)
+ */
+string deflate(const string& data, int windowBits)
+{
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if(deflateInit2(&zs, 6, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		throw std::runtime_error("Could not init zlib!");
+	string out(deflateBound(&zs, data.size()), '\0');
+	zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+	zs.avail_in = data.size();
+	zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+	zs.avail_out = out.size();
+	deflate(&zs, Z_FINISH);
+	out.resize(zs.total_out);
+	deflateEnd(&zs);
+	return out;
+}
+
+void putLittleEndian(string& s, uint32_t value, size_t bytes)
+{
+	for(size_t i=0;i<bytes;i++)
+		s += (char)((value >> (8 * i)) & 0xff);
+}
+
+/*
+ * a gzip member of stored deflate blocks - its size is exactly 18 + data.size() + 5 * the blocks of 65535 bytes
+ */
+string storedGzip(const string& data)
+{
+	string out("\x1f\x8b\x08\0\0\0\0\0\0\xff", 10);
+	for(size_t begin = 0; begin < data.size(); begin += 65535)
+	{
+		size_t len = std::min<size_t>(65535, data.size() - begin);
+		out += (char)(begin + len == data.size() ? 1 : 0);
+		putLittleEndian(out, len, 2);
+		putLittleEndian(out, ~len & 0xffff, 2);
+		out += data.substr(begin, len);
+	}
+	putLittleEndian(out, crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data.data()), data.size()), 4);
+	putLittleEndian(out, data.size(), 4);
+	return out;
+}
+
+/*
+ * members of 60000 bytes and the empty one marking the end of the file as bgzip writes them
+ */
+string bgzf(const string& data)
+{
+	string out;
+	for(size_t begin = 0; ; begin += 60000)
+	{
+		string chunk = data.substr(std::min(begin, data.size()), 60000);
+		string compressed = deflate(chunk, -15);
+		out += string("\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0", 16);
+		putLittleEndian(out, compressed.size() + 25, 2);
+		out += compressed;
+		putLittleEndian(out, crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(chunk.data()), chunk.size()), 4);
+		putLittleEndian(out, chunk.size(), 4);
+		if(chunk.empty())
+			return out;
+	}
+}
+
+/*
+ * takes every block of the reader until the end of the stream (throws the error of the reader)
+ */
+size_t readAll(const string& path)
+{
+	unique_ptr<io::FileReader> reader = io::openFileReader(path);
+	reader->startReadingBlocks();
+	size_t bytes = 0;
+	while(true)
+	{
+		InputBuffer buffer;
+		reader->getNextBlock(buffer);
+		bytes += buffer.getLen();
+		reader->recycle(buffer.getBuffer());
+		if(buffer.isEndofStream())
+			break;
+	}
+	reader->waitReading();
+	return bytes;
+}
+
+void count(const string& path, size_t k, const EngineConfig& config = EngineConfig())
+{
+	std::ostringstream log;
+	EngineConfig quiet = config;
+	quiet.out = &log;
+	KmerEngine engine(path, k, 10, 4, quiet);
+	engine.start();
+	engine.getResults();
+}
+
+void testCompressedInputs()
+{
+	string data = sequence(1 << 20);
+
+	string gzip = deflate(data, 15 + 16);
+	writeFile("test_input.gz", gzip);
+	check("gzip reads through", errorOf([]() { readAll("test_input.gz"); }).empty());
+
+	writeFile("test_truncated.gz", gzip.substr(0, gzip.size() / 2));
+	expectError("truncated gzip: reader", "Truncated gzip file", []() { readAll("test_truncated.gz"); });
+	expectError("truncated gzip: engine", "Truncated gzip file", []() { count("test_truncated.gz", 21); });
+
+	// a member ending right where the reader's input chunk of 1 MiB does: 16 blocks, 18 + 16 * 5 + data bytes
+	string exact = sequence(1 << 20).substr(0, (1 << 20) - 18 - 16 * 5);
+	string member = storedGzip(exact);
+	writeFile("test_exact.gz", member);
+	size_t bytes = 0;
+	string error = errorOf([&bytes]() { bytes = readAll("test_exact.gz"); });
+	check("gzip member of exactly 1 MiB", member.size() == (1 << 20) && error.empty() && bytes == exact.size(), error);
+
+	string next = sequence(1 << 16);
+	writeFile("test_exact.gz", member + deflate(next, 15 + 16) + member);
+	bytes = 0;
+	error = errorOf([&bytes]() { bytes = readAll("test_exact.gz"); });
+	check("gzip members, the first of exactly 1 MiB", error.empty() && bytes == 2 * exact.size() + next.size(), error);
+
+	// two members of 8 blocks, together exactly 1 MiB
+	string half = exact.substr(0, (1 << 19) - 18 - 8 * 5);
+	string members = storedGzip(half) + storedGzip(half);
+	writeFile("test_exact.gz", members);
+	bytes = 0;
+	error = errorOf([&bytes]() { bytes = readAll("test_exact.gz"); });
+	check("gzip members of exactly 1 MiB", members.size() == (1 << 20) && error.empty() && bytes == 2 * half.size(), error);
+
+	string corrupt = gzip;
+	for(size_t i = corrupt.size() / 2; i < corrupt.size() / 2 + 16; i++)
+		corrupt[i] ^= 0x5a;
+	writeFile("test_corrupt.gz", corrupt);
+	expectError("corrupt gzip: engine", "Corrupt gzip file", []() { count("test_corrupt.gz", 21); });
+
+	string blocked = bgzf(data);
+	writeFile("test_input.bgz", blocked);
+	check("bgzf reads through", errorOf([]() { readAll("test_input.bgz"); }).empty());
+
+	// a byte of the data of a member in the middle: the crc (or inflate) catches it on the pool
+	corrupt = blocked;
+	corrupt[corrupt.size() / 2] ^= 0xff;
+	writeFile("test_corrupt.bgz", corrupt);
+	expectError("corrupt bgzf: reader", "Corrupt bgzf", []() { readAll("test_corrupt.bgz"); });
+	expectError("corrupt bgzf: engine", "Corrupt bgzf", []() { count("test_corrupt.bgz", 21); });
+	expectError("corrupt bgzf: engine, several k", "Corrupt bgzf", []()
+				{
+					std::ostringstream log;
+					EngineConfig config;
+					config.out = &log;
+					KmerEngine engine("test_corrupt.bgz", vector<size_t>{12, 31}, 10, 4, config);
+					engine.start();
+				});
+
+	writeFile("test_truncated.bgz", blocked.substr(0, blocked.size() / 2));
+	expectError("truncated bgzf: engine", "bgzf", []() { count("test_truncated.bgz", 21); });
+
+	// the engine is done with the reader once it failed - the next one counts as usual
+	check("counting after a failed input", errorOf([]() { count("test_input.bgz", 21); }).empty());
+
+	remove("test_input.gz");
+	remove("test_exact.gz");
+	remove("test_truncated.gz");
+	remove("test_corrupt.gz");
+	remove("test_input.bgz");
+	remove("test_corrupt.bgz");
+	remove("test_truncated.bgz");
+}
+
+/*
+ * a database with one field of the header broken at a time: opening it fails instead of mapping past the file
+ */
+void testCorruptDatabase()
+{
+	writeFile("test_db_input", sequence(1 << 16));
+	EngineConfig config;
+	config.databasePath = "test.db";
+	count("test_db_input", 11, config);
+	std::ifstream in("test.db", std::ios_base::binary);
+	string good((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	check("database opens", errorOf([]() { KmerDatabase database("test.db"); }).empty());
+
+	DatabaseHeader header;
+	memcpy(&header, good.data(), sizeof(header));
+	vector<pair<string, std::function<void(DatabaseHeader&)>>> broken = {
+		{"index bits", [](DatabaseHeader& h) { h.indexBits = 30; }},
+		{"no count bytes", [](DatabaseHeader& h) { h.countBytes = 0; }},
+		{"count bytes", [](DatabaseHeader& h) { h.countBytes = 9; }},
+		{"index offset", [](DatabaseHeader& h) { h.indexOffset = ~(uint64_t)0 - 8; }},
+		{"index past the records", [](DatabaseHeader& h) { h.recordsOffset -= 8; }},
+		{"records offset", [](DatabaseHeader& h) { h.recordsOffset = ~(uint64_t)0 - 8; }},
+		{"number of kmers", [](DatabaseHeader& h) { h.numOfKmers = ((uint64_t)1 << 62) + 1; }}};
+	for(auto& b : broken)
+	{
+		DatabaseHeader h = header;
+		b.second(h);
+		string corrupt = good;
+		memcpy(&corrupt[0], &h, sizeof(h));
+		writeFile("test.db", corrupt);
+		expectError("corrupt database: " + b.first, "truncated or corrupt", []() { KmerDatabase database("test.db"); });
+	}
+
+	remove("test_db_input");
+	remove("test.db");
+}
+
+/*
+ * files of the working directory starting with prefix
+ */
+size_t filesStartingWith(const string& prefix)
+{
+	size_t files = 0;
+	DIR* dir = opendir(".");
+	while(dirent* entry = dir ? readdir(dir) : nullptr)
+		if(string(entry->d_name).compare(0, prefix.size(), prefix) == 0)
+			++files;
+	if(dir)
+		closedir(dir);
+	return files;
+}
+
+/*
+ * an input failing after the partitions spilled: the runs go away with the engine
+ */
+void testSpillCleanup()
+{
+	writeFile("test_failing_spill.fa", ">r1\n" + sequence(1 << 22) + "ACGTRYACGT\n");
+	EngineConfig config;
+	config.maxMemory = 16 << 20;
+	config.spillPrefix = "test_spill";
+	expectError("input failing after spilling", "Invalid char", [&config]() { count("test_failing_spill.fa", 21, config); });
+	check("spilled runs removed", filesStartingWith("test_spill") == 0);
+	remove("test_failing_spill.fa");
+}
+
+/*
+ * an input failing on the workers (an invalid base) and one failing on the reader next to good ones in a batch: only
+ * they fail, the good ones are counted as if alone
+ */
+void testBatchIsolation()
+{
+	writeFile("test_good_1", sequence(1 << 19));
+	writeFile("test_good_2", sequence(1 << 18));
+	writeFile("test_bad.fa", ">r1\nACGTACGTACGTACGTACGTACGTACGTRYACGTACGT\n" + sequence(1 << 16));
+	string gzip = deflate(sequence(1 << 20), 15 + 16);
+	writeFile("test_truncated.gz", gzip.substr(0, gzip.size() / 2));
+	vector<BatchInput> inputs = {{"test_good_1", ""}, {"test_bad.fa", ""}, {"test_truncated.gz", ""}, {"test_good_2", ""}};
+
+	vector<size_t> ks = {12, 21};
+	for(bool shared : {false, true})
+	{
+		string mode = shared ? " (shared table)" : "";
+		EngineConfig config;
+		config.sharedTable = shared;
+		vector<BatchResult> results(inputs.size());
+		string error = errorOf([&]()
+							   {
+								KmerBatch batch(inputs, ks, 10, 4, config, 2);
+								batch.run([&results](const BatchResult& r) { results[r.index] = r; });
+							   });
+		check("batch with bad inputs runs through" + mode, error.empty(), error);
+		check("invalid base fails its input" + mode, results[1].error.find("Invalid char") != string::npos, results[1].error);
+		check("truncated gzip fails its input" + mode, results[2].error.find("Truncated gzip") != string::npos, results[2].error);
+
+		for(size_t i : {0, 3})
+		{
+			const BatchResult& r = results[i];
+			bool same = r.error.empty() && r.results.size() == ks.size();
+			for(size_t j=0;j<ks.size() && same;j++)
+			{
+				std::ostringstream log;
+				EngineConfig alone = config;
+				alone.out = &log;
+				KmerEngine engine(inputs[i].path, ks[j], 10, 4, alone);
+				engine.start();
+				// the ties come in any order out of the shared table
+				vector<pair<string, size_t>> expected = engine.getResults();
+				vector<pair<string, size_t>> counted = r.results[j];
+				std::sort(expected.begin(), expected.end());
+				std::sort(counted.begin(), counted.end());
+				same = expected == counted && engine.totalKmerCount() == r.totalKmerCounts[j];
+			}
+			check(inputs[i].path + " counted next to the bad ones" + mode, same, r.error);
+		}
+	}
+
+	remove("test_good_1");
+	remove("test_good_2");
+	remove("test_bad.fa");
+	remove("test_truncated.gz");
+}
+
+}
+
+int main()
+{
+	testCompressedInputs();
+	testCorruptDatabase();
+	testSpillCleanup();
+	testBatchIsolation();
+	cout << (failures ? "Some checks failed!\n" : "All checks passed!\n");
+	return failures ? 1 : 0;
+}